@@ -0,0 +1,150 @@
+#pragma once
+
+#include <algorithm>
+#include <exception>
+#include <memory>
+#include <numeric>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "determinant.hpp"
+
+
+namespace thrd {
+
+/*
+  How a batch is run: the workers each matrix gets and the order they start
+  in. Matrices up to Tuning::serialMax rows get one worker, so many of them
+  run side by side, one per core. Bigger ones get a worker per rowsPerThread
+  rows, as DeterminantAuto would give them. The order is longest first (LPT),
+  so the big ones don't end up alone at the tail of the batch.
+*/
+struct BatchPlan
+{
+  std::vector<size_t> workers;
+  std::vector<size_t> order;
+  size_t threads = 1;
+};
+
+BatchPlan PlanBatch(const std::vector<size_t>&, size_t = 0);
+
+template<typename T, typename Layout>
+std::vector<ld_t> DeterminantBatch(std::vector< Matrix<T, Layout> >&, size_t = 0,
+                                   const DeterminantMethods::Methods = DeterminantMethods::LU);
+template<typename T, typename Layout>
+std::vector<ld_t> DeterminantBatch(std::vector< Matrix<T, Layout> >&, const BatchPlan&,
+                                   const DeterminantMethods::Methods = DeterminantMethods::LU);
+
+
+BatchPlan PlanBatch(const std::vector<size_t>& sizes, size_t threadsCount)
+{
+  if (threadsCount < 1) threadsCount = std::max(std::thread::hardware_concurrency(), 1u);
+
+  BatchPlan plan;
+  plan.threads = threadsCount;
+  plan.workers.resize(sizes.size());
+  plan.order.resize(sizes.size());
+
+  const auto& tuning = Tuning::Get();
+  const auto rowsPerThread = std::max(tuning.rowsPerThread, static_cast<size_t>(1));
+  for (size_t i = 0; i < sizes.size(); ++i) {
+    auto workers = sizes[i] <= tuning.serialMax ? 1 : sizes[i] / rowsPerThread;
+    plan.workers[i] = std::max(std::min(workers, threadsCount), static_cast<size_t>(1));
+  }
+
+  // n^3 work, ties keep the submission order
+  std::iota(plan.order.begin(), plan.order.end(), 0);
+  std::stable_sort(plan.order.begin(), plan.order.end(), [&](size_t a, size_t b) { return sizes[a] > sizes[b]; });
+  return plan;
+}
+
+template<typename T, typename Layout>
+std::vector<ld_t> DeterminantBatch(
+    std::vector< Matrix<T, Layout> >&  matrices,
+    size_t                             threadsCount,
+    const DeterminantMethods::Methods  method)
+{
+  std::vector<size_t> sizes(matrices.size());
+  for (size_t i = 0; i < matrices.size(); ++i) {
+    sizes[i] = matrices[i].size();
+  }
+  return DeterminantBatch(matrices, PlanBatch(sizes, threadsCount), method);
+}
+
+/*
+  Runs the plan on plan.threads drivers sharing a budget of as many workers.
+  A driver takes the next matrix in order, waits until enough workers are
+  free and runs it with them: LU and Laplace on as many threads of their own,
+  the pooled methods on a pool of workers - 1 threads the driver keeps for
+  the call, with the driver as the last one. So the workers granted are the
+  threads the matrix gets, and the batch runs at most plan.threads threads
+  at once. Matrices start strictly in plan order, so a wide matrix can't be
+  starved by the small ones behind it.
+*/
+template<typename T, typename Layout>
+std::vector<ld_t> DeterminantBatch(
+    std::vector< Matrix<T, Layout> >&  matrices,
+    const BatchPlan&                   plan,
+    const DeterminantMethods::Methods  method)
+{
+  std::vector<ld_t> results(matrices.size(), 0);
+  std::mutex mtx;
+  std::condition_variable cv;
+  size_t next = 0;
+  size_t turn = 0;
+  size_t free = plan.threads;
+  std::exception_ptr error;
+
+  auto drive = [&]() {
+    std::unique_ptr<ThreadPool> pool;
+    while (true) {
+      std::unique_lock<std::mutex> lock(mtx);
+      if (next >= plan.order.size() || error) return;
+      auto ticket = next++;
+      auto index = plan.order[ticket];
+      auto workers = std::min(plan.workers[index], plan.threads);
+      cv.wait(lock, [&]() { return turn == ticket && free >= workers; });
+      free -= workers;
+      ++turn;
+      lock.unlock();
+      cv.notify_all();
+
+      try {
+        if (workers > 1 && (!pool || pool->size() != workers - 1)) {
+          pool.reset(new ThreadPool(workers - 1));
+        }
+        if (workers > 1) {
+          ThreadPool::Scope scope(*pool);
+          results[index] = matrices[index].Determinant(workers, method);
+        } else {
+          results[index] = matrices[index].Determinant(workers, method);
+        }
+      } catch (...) {
+        lock.lock();
+        if (!error) error = std::current_exception();
+        lock.unlock();
+      }
+
+      lock.lock();
+      free += workers;
+      lock.unlock();
+      cv.notify_all();
+    }
+  };
+
+  std::vector<std::thread> drivers;
+  for (size_t i = 1; i < std::min(plan.threads, matrices.size()); ++i) {
+    drivers.emplace_back(drive);
+  }
+  drive();
+  for (auto& driver : drivers) {
+    driver.join();
+  }
+
+  if (error) std::rethrow_exception(error);
+  return results;
+}
+
+} // namespace thrd
@@ -1,11 +1,17 @@
 #define BENCHPRESS_FILE_OUTPUT
+#define BENCHPRESS_TRACK_ALLOCATIONS
 
+#include <cmath>
 #include <chrono>
 #include <thread>
+#include <fstream>
 #include <iostream>
 #include <algorithm>
+#include <map>
+#include <string>
 
 #include "benchpress_edited.hpp"
+#include "cxxopts.hpp"
 #include "determinant.hpp"
 #include "samples.hpp"
 
@@ -23,102 +29,232 @@ benchpress::registration* benchpress::registration::d_this;
 // });
 
 
-BENCHMARK("La: Random 10x10 matrix", [](benchpress::context* ctx) {
-  ctx->reset_timer();
-  for (size_t i = 1; i < ctx->num_iterations() && i < 10; ++i) {
-    sample::RandomMatrix(10).DeterminantLaplace( ctx->num_threads() );
-  }
-});
+using Methods = thrd::DeterminantMethods;
 
-BENCHMARK("La: Triangle NxN matrix", [](benchpress::context* ctx) {
-  ctx->reset_timer();
-  for (size_t i = 2; i <= ctx->num_iterations() && i < 12; ++i) {
-    sample::TriangleMatrix(i, i).DeterminantLaplace( ctx->num_threads() );
-  }
-});
+const std::map<std::string, Methods::Methods> methods = {
+  { "LAPLACE", Methods::LAPLACE },
+  { "LU", Methods::LU },
+  { "RLU", Methods::RLU },
+  { "TILED", Methods::TILED },
+  { "AUTO", Methods::AUTO }
+};
 
-BENCHMARK("La: Random NxN matrix", [](benchpress::context* ctx) {
-  ctx->reset_timer();
-  for (size_t i = 2; i <= ctx->num_iterations() && i < 12; ++i) {
-    sample::RandomMatrix(i).DeterminantLaplace( ctx->num_threads() );
+const size_t POOL_SIZE = 4;
+
+// inputs come from a pool built once per benchmark, each from its own seed, only the determinants are timed
+template<typename T, typename F>
+void Determinants(benchpress::context* ctx, F make)
+{
+  auto& inputs = ctx->pool< thrd::Matrix<T> >("inputs", POOL_SIZE, [&](size_t k) { return thrd::Matrix<T>(make(k)); });
+  auto method = ctx->param("method");
+  if (method != "LAPLACE") {
+    // nominal LU count, the same for every method so GFLOP/s compare directly
+    double n = static_cast<double>(ctx->size());
+    ctx->set_flops(2 * n * n * n / 3);
   }
-});
+  ctx->each_iteration([&](size_t i) {
+    auto& M = inputs[i % inputs.size()];
+    if (method == "CERTIFIED") {
+      M.DeterminantCertified(ctx->num_threads());
+    } else {
+      M.Determinant(ctx->num_threads(), methods.at(method));
+    }
+  });
+}
 
-BENCHMARK("La: Hilbert NxN matrix", [](benchpress::context* ctx) {
-  ctx->reset_timer();
-  for (size_t i = 2; i <= ctx->num_iterations() && i < 12; ++i) {
-    sample::Hilbert(i).DeterminantLaplace( ctx->num_threads() );
+template<typename F>
+void ByPrecision(benchpress::context* ctx, F make)
+{
+  auto precision = ctx->param("precision");
+  if (precision == "float") {
+    Determinants<float>(ctx, make);
+  } else if (precision == "double") {
+    Determinants<double>(ctx, make);
+  } else {
+    Determinants<long double>(ctx, make);
   }
+}
+
+
+BENCHMARK_P("La: Random matrix", {
+  benchpress::axis("size", { 5, 6, 7, 8, 9 }),
+  benchpress::axis::threads(),
+  benchpress::axis("method", { "LAPLACE" })
+}, [](benchpress::context* ctx) {
+  Determinants<sample::value_t>(ctx, [&](size_t seed) { return sample::RandomMatrix(ctx->size(), seed); });
 });
 
-BENCHMARK("LU: Random 10x10 matrix", [](benchpress::context* ctx) {
-  ctx->reset_timer();
-  for (size_t i = 1; i < ctx->num_iterations(); ++i) {
-    sample::RandomMatrix(200).DeterminantLU( ctx->num_threads() );
-  }
+BENCHMARK_P("Det: Random matrix", {
+  benchpress::axis::range("size", 50, 400),
+  benchpress::axis::threads(),
+  benchpress::axis("method", { "LU", "RLU", "TILED", "AUTO", "CERTIFIED" }),
+  benchpress::axis("precision", { "float", "double", "long double" })
+}, [](benchpress::context* ctx) {
+  ByPrecision(ctx, [&](size_t seed) { return sample::RandomMatrix(ctx->size(), seed); });
 });
 
-BENCHMARK("LU: Triangle NxN matrix", [](benchpress::context* ctx) {
-  ctx->reset_timer();
-  for (size_t i = 2; i <= ctx->num_iterations(); ++i) {
-    sample::TriangleMatrix(i, i).DeterminantLU( ctx->num_threads() );
-  }
+BENCHMARK_P("Det: Triangle matrix", {
+  benchpress::axis::range("size", 50, 400),
+  benchpress::axis::threads(),
+  benchpress::axis("method", { "LU", "AUTO" }),
+  benchpress::axis("precision", { "long double" })
+}, [](benchpress::context* ctx) {
+  ByPrecision(ctx, [&](size_t seed) { return sample::TriangleMatrix(ctx->size(), 2, seed); });
 });
 
-BENCHMARK("LU: Random NxN matrix", [](benchpress::context* ctx) {
-  ctx->reset_timer();
-  for (size_t i = 2; i <= ctx->num_iterations(); ++i) {
-    sample::RandomMatrix(i).DeterminantLU( ctx->num_threads() );
-  }
+BENCHMARK_P("Det: Hilbert matrix", {
+  benchpress::axis::range("size", 8, 64),
+  benchpress::axis::threads(),
+  benchpress::axis("method", { "LU", "CERTIFIED" }),
+  benchpress::axis("precision", { "long double" })
+}, [](benchpress::context* ctx) {
+  ByPrecision(ctx, [&](size_t) { return sample::Hilbert(ctx->size()); });
 });
 
-BENCHMARK("LU: Hilbert NxN matrix", [](benchpress::context* ctx) {
-  ctx->reset_timer();
-  for (size_t i = 2; i <= ctx->num_iterations(); ++i) {
-    sample::Hilbert(i).DeterminantLU( ctx->num_threads() );
-  }
+BENCHMARK_P("Det: Distributions", {
+  benchpress::axis::range("size", 64, 256),
+  benchpress::axis::threads(),
+  benchpress::axis("method", { "LU", "AUTO" }),
+  benchpress::axis("matrix", { "uniform", "normal", "conditioned", "sparse", "banded", "spd" }),
+  benchpress::axis("precision", { "double" })
+}, [](benchpress::context* ctx) {
+  auto n = ctx->size();
+  auto kind = ctx->param("matrix");
+  ByPrecision(ctx, [&](size_t seed) {
+    if (kind == "uniform") return sample::UniformMatrix(n, seed);
+    if (kind == "normal") return sample::NormalMatrix(n, seed);
+    if (kind == "conditioned") return sample::ConditionedMatrix(n, 1e6, seed);
+    if (kind == "sparse") return sample::SparseMatrix(n, 0.1, seed);
+    if (kind == "banded") return sample::BandedMatrix(n, 8, 8, seed);
+    return sample::SpdMatrix(n, seed);
+  });
 });
 
-BENCHMARK("Det: Random 200x200 matrix", [](benchpress::context* ctx) {
-  ctx->reset_timer();
-  for (size_t i = 1; i < ctx->num_iterations(); ++i) {
-    sample::RandomMatrix(200).Determinant( ctx->num_threads() );
-  }
+// n^3 / threads stays the same, the scaling report reads it from the work parameter
+BENCHMARK_P("Det: Weak scaling", {
+  benchpress::axis("work", { 128, 256 }),
+  benchpress::axis::threads(),
+  benchpress::axis("method", { "LU", "TILED" }),
+  benchpress::axis("precision", { "double" })
+}, [](benchpress::context* ctx) {
+  auto work = static_cast<double>(ctx->param_int("work"));
+  ctx->set_size(static_cast<size_t>(std::round(work * std::cbrt(static_cast<double>(ctx->num_threads())))));
+  ByPrecision(ctx, [&](size_t seed) { return sample::RandomMatrix(ctx->size(), seed); });
 });
 
 
 int main(int argc, char** argv)
 {
-  std::cout << "Benchmark started..." << std::endl;
-
   auto threadsCount = std::thread::hardware_concurrency();
   if (threadsCount < 1) threadsCount = 1;
 
   benchpress::options bench_opts;
+  std::string jsonPath, csvPath, baselinePath, profilePath;
+  double alpha = 0.05, threshold = 5;
+  try {
+    cxxopts::Options cmd_opts(argv[0], " - determinant benchmarks");
+    cmd_opts.add_options()
+      ("bench", "run benchmarks matching the regular expression", cxxopts::value<std::string>()->default_value(".*"))
+      ("benchtime", "seconds to spend on each benchmark", cxxopts::value<size_t>()->default_value("1"))
+      ("samples", "most timed samples per benchmark", cxxopts::value<size_t>()->default_value("20"))
+      ("min-samples", "fewest timed samples per benchmark", cxxopts::value<size_t>()->default_value("5"))
+      ("warmup", "seconds each benchmark runs before it is timed", cxxopts::value<double>()->default_value("0.1"))
+      ("confidence", "stop sampling when the 95% interval of the mean is within this fraction of it",
+        cxxopts::value<double>()->default_value("0.02"))
+      ("cpu", "threads axis goes up to cpu", cxxopts::value<size_t>()->default_value(std::to_string(threadsCount)))
+      ("json", "write the results as json to the file", cxxopts::value<std::string>())
+      ("csv", "write the results as csv to the file", cxxopts::value<std::string>())
+      ("baseline", "compare with the json of an earlier run, exit with 1 on slowdowns", cxxopts::value<std::string>())
+      ("threshold", "smallest slowdown of the median counted, in percent", cxxopts::value<double>()->default_value("5"))
+      ("alpha", "significance level of the Mann-Whitney test", cxxopts::value<double>()->default_value("0.05"))
+      ("counters", "read hardware counters of all threads, if the system allows it")
+      ("allocs", "count allocations and the peak resident memory of every benchmark")
+      ("profile", "sample the call stacks of the benchmarks, write them folded to the file", cxxopts::value<std::string>())
+      ("profile-rate", "stack samples per cpu second", cxxopts::value<size_t>()->default_value("997"))
+      ("help", "print help")
+    ;
+    cmd_opts.parse(argc, argv);
+    if (cmd_opts.count("help")) {
+      std::cout << cmd_opts.help({""}) << std::endl;
+      return 0;
+    }
+    bench_opts.bench(cmd_opts["bench"].as<std::string>());
+    bench_opts.benchtime(cmd_opts["benchtime"].as<size_t>());
+    bench_opts.samples(cmd_opts["samples"].as<size_t>());
+    bench_opts.min_samples(cmd_opts["min-samples"].as<size_t>());
+    bench_opts.warmup(cmd_opts["warmup"].as<double>());
+    bench_opts.confidence(cmd_opts["confidence"].as<double>());
+    bench_opts.counters(cmd_opts.count("counters") > 0);
+    bench_opts.allocations(cmd_opts.count("allocs") > 0);
+    if (cmd_opts.count("profile")) {
+      profilePath = cmd_opts["profile"].as<std::string>();
+      bench_opts.profile(cmd_opts["profile-rate"].as<size_t>());
+    }
+    threadsCount = std::max(cmd_opts["cpu"].as<size_t>(), static_cast<size_t>(1));
+    if (cmd_opts.count("json")) jsonPath = cmd_opts["json"].as<std::string>();
+    if (cmd_opts.count("csv")) csvPath = cmd_opts["csv"].as<std::string>();
+    if (cmd_opts.count("baseline")) baselinePath = cmd_opts["baseline"].as<std::string>();
+    threshold = cmd_opts["threshold"].as<double>();
+    alpha = cmd_opts["alpha"].as<double>();
+  } catch (const cxxopts::OptionException& e) {
+    std::cerr << "error parsing options: " << e.what() << std::endl;
+    return 1;
+  }
 
-  float timeTaken = 0.f;
+  std::cout << "Benchmark started..." << std::endl;
 
-  for (auto i = 1; i <= threadsCount; ++i) {    
-    std::chrono::high_resolution_clock::time_point bp_start = std::chrono::high_resolution_clock::now();
-    
-    bench_opts.cpu(i);
-    benchpress::run_benchmarks(bench_opts);
+  std::chrono::high_resolution_clock::time_point bp_start = std::chrono::high_resolution_clock::now();
 
-    float duration = std::chrono::duration_cast<std::chrono::milliseconds>(
-            std::chrono::high_resolution_clock::now() - bp_start
-    ).count() / 1000.f;
+  bench_opts.cpu(threadsCount);
+  auto results = benchpress::run_benchmarks(bench_opts);
+  auto fits = benchpress::fit_complexity(results);
+  auto scalings = benchpress::fit_scaling(results);
 
-    std::cout << "Processed " << i << " of " << threadsCount << std::endl;
+  float timeTaken = std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::high_resolution_clock::now() - bp_start
+  ).count() / 1000.f;
 
-    benchpress::out_stream << std::endl;
-    benchpress::out_stream << "Time taken: " << duration << "s" << std::endl;
-    benchpress::out_stream << "Threads used: " << i << std::endl;
-    benchpress::out_stream << std::endl << std::endl;
+  benchpress::out_stream << std::endl << "Complexity:" << std::endl;
+  benchpress::write_complexity(benchpress::out_stream, fits);
+  benchpress::out_stream << std::endl;
+  benchpress::write_scaling(benchpress::out_stream, scalings);
+  benchpress::out_stream << "Time taken: " << timeTaken << "s" << std::endl;
+  benchpress::out_stream << "Threads used: up to " << threadsCount << std::endl;
 
-    timeTaken += duration;
+  if (!jsonPath.empty()) {
+    std::ofstream json(jsonPath, std::ofstream::trunc);
+    benchpress::write_json(json, results);
+  }
+  if (!csvPath.empty()) {
+    std::ofstream csv(csvPath, std::ofstream::trunc);
+    benchpress::write_csv(csv, results);
+  }
+  if (!profilePath.empty()) {
+    std::ofstream profile(profilePath, std::ofstream::trunc);
+    benchpress::write_profile(profile, results);
   }
 
   std::cout << "Benchmark finished in " << timeTaken << "s" << std::endl;
 
+  if (!baselinePath.empty()) {
+    std::ifstream baseline(baselinePath);
+    if (!baseline) {
+      std::cerr << "can't read the baseline " << baselinePath << std::endl;
+      return 1;
+    }
+    try {
+      auto comparisons = benchpress::compare_baseline(baseline, results, alpha, threshold / 100);
+      benchpress::out_stream << std::endl << "Compared with " << baselinePath << ":" << std::endl;
+      benchpress::write_comparison(benchpress::out_stream, comparisons);
+      if (benchpress::has_regressions(comparisons)) {
+        std::cout << "Slower than the baseline" << std::endl;
+        return 1;
+      }
+    } catch (const std::runtime_error& e) {
+      std::cerr << "can't read the baseline " << baselinePath << ": " << e.what() << std::endl;
+      return 1;
+    }
+  }
+
   return 0;
 }
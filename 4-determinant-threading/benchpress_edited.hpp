@@ -25,16 +25,45 @@
 #include <algorithm>   // max, min
 #include <atomic>      // atomic_intmax_t
 #include <chrono>      // high_resolution_timer, duration
+#include <cmath>       // sqrt, floor                       edited section: distributions
+#include <cstdint>     // uint64_t                          edited section: hardware counters
+#include <cstdlib>     // atoi                              edited section: hardware counters
+#include <cstring>     // strlen                            edited section: allocation tracking
 #include <functional>  // function
+#include <initializer_list> // initializer_list            edited section: parameterized benchmarks
 #include <iomanip>     // setw
 #include <iostream>    // cout
 #include <regex>       // regex, regex_match
 #include <sstream>     // stringstream
 #include <string>      // string
 #include <thread>      // thread
+#include <utility>     // pair                              edited section: parameterized benchmarks
 #include <vector>      // vector
 
 #include <fstream>     // edited section: output to file
+#include <map>         // edited section: build info
+#include <memory>      // edited section: fixtures
+#include <stdexcept>   // edited section: regression gate
+#include <array>       // edited section: hardware counters
+#include <new>         // edited section: allocation tracking
+#include <sys/resource.h>
+
+#ifdef __linux__       // edited section: hardware counters
+#include <dirent.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#endif
+
+#if defined(__linux__) && defined(__GLIBC__)   // edited section: sampling profiler
+#define BENCHPRESS_CAN_PROFILE
+#include <csignal>
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <sys/time.h>
+#endif
 
 namespace benchpress {
 
@@ -63,11 +92,25 @@ class options {
     std::string d_bench;
     size_t      d_benchtime;
     size_t      d_cpu;
+    size_t      d_samples;   // edited section: distributions, the most taken
+    size_t      d_min_samples;   // edited section: adaptive sampling
+    double      d_warmup;
+    double      d_confidence;
+    bool        d_counters;  // edited section: hardware counters
+    bool        d_allocations;   // edited section: allocation tracking
+    size_t      d_profile_rate;  // edited section: sampling profiler, samples per cpu second, 0 when off
 public:
     options()
         : d_bench(".*")
         , d_benchtime(1)
         , d_cpu(std::thread::hardware_concurrency())
+        , d_samples(20)
+        , d_min_samples(5)
+        , d_warmup(0.1)
+        , d_confidence(0.02)
+        , d_counters(false)
+        , d_allocations(false)
+        , d_profile_rate(0)
     {}
     options& bench(const std::string& bench) {
         d_bench = bench;
@@ -90,10 +133,113 @@ public:
     size_t get_cpu() const {
         return d_cpu;
     }
+    // edited section: distributions
+    options& samples(size_t samples) {
+        d_samples = std::max(samples, size_t(1));
+        return *this;
+    }
+    size_t get_samples() const {
+        return d_samples;
+    }
+    // edited section: adaptive sampling
+    options& min_samples(size_t samples) {
+        d_min_samples = std::max(samples, size_t(1));
+        return *this;
+    }
+    size_t get_min_samples() const {
+        return std::min(d_min_samples, d_samples);
+    }
+    // seconds each benchmark runs untimed before the first sample
+    options& warmup(double warmup) {
+        d_warmup = std::max(warmup, 0.0);
+        return *this;
+    }
+    double get_warmup() const {
+        return d_warmup;
+    }
+    // sampling stops once the 95% confidence interval of the mean is within this fraction of it
+    options& confidence(double confidence) {
+        d_confidence = confidence;
+        return *this;
+    }
+    double get_confidence() const {
+        return d_confidence;
+    }
+    // edited section: hardware counters
+    options& counters(bool counters) {
+        d_counters = counters;
+        return *this;
+    }
+    bool get_counters() const {
+        return d_counters;
+    }
+    // edited section: allocation tracking
+    options& allocations(bool allocations) {
+        d_allocations = allocations;
+        return *this;
+    }
+    bool get_allocations() const {
+        return d_allocations;
+    }
+    // edited section: sampling profiler
+    options& profile(size_t rate) {
+        d_profile_rate = rate;
+        return *this;
+    }
+    size_t get_profile_rate() const {
+        return d_profile_rate;
+    }
 };
 
 class context;
 
+/*
+ * edited section: parameterized benchmarks
+ * The axis class is one parameter of a benchmark and the values it takes. A benchmark with axes is run once for
+ * every combination of their values, each one measured on its own.
+ *
+ * axis("size", {64, 128, 256});
+ * axis("method", {"LU", "RLU"});
+ * axis::threads();   // 1, 2, 4, ... up to options.cpu()
+ */
+class axis {
+    std::string              d_name;
+    std::vector<std::string> d_values;
+
+public:
+    axis(std::string name, std::initializer_list<long long> values)
+        : d_name(name)
+    {
+        for (auto v : values) {
+            d_values.push_back(std::to_string(v));
+        }
+    }
+    axis(std::string name, std::initializer_list<std::string> values)
+        : d_name(name)
+        , d_values(values)
+    {}
+
+    // values are filled in when the benchmarks run, from the options
+    static axis threads() {
+        return axis("threads", std::initializer_list<std::string>());
+    }
+
+    // from, from * factor, ... up to to
+    static axis range(std::string name, long long from, long long to, long long factor = 2) {
+        axis a(name, std::initializer_list<std::string>());
+        for (auto v = from; v <= to; v *= std::max(factor, 2LL)) {
+            a.d_values.push_back(std::to_string(v));
+        }
+        return a;
+    }
+
+    const std::string&              get_name() const { return d_name; }
+    const std::vector<std::string>& get_values() const { return d_values; }
+};
+
+// parameter name -> value of one run of a parameterized benchmark
+typedef std::vector<std::pair<std::string, std::string>> params;
+
 /*
  * The benchmark_info class is used to store a function name / pointer pair.
  *
@@ -104,15 +250,54 @@ class context;
 class benchmark_info {
     std::string                   d_name;
     std::function<void(context*)> d_func;
+    std::vector<axis>             d_axes;     // edited section: parameterized benchmarks
+    params                        d_params;
 
 public:
-    benchmark_info(std::string name, std::function<void(context*)> func)
+    benchmark_info(std::string name, std::function<void(context*)> func, std::vector<axis> axes = {})
         : d_name(name)
         , d_func(func)
+        , d_axes(axes)
     {}
 
     std::string                   get_name() const { return d_name; }
     std::function<void(context*)> get_func() const { return d_func; }
+
+    // edited section: parameterized benchmarks
+    const std::vector<axis>& get_axes() const { return d_axes; }
+    const params&            get_params() const { return d_params; }
+
+    // name of a single run, e.g. "LU/size:64/threads:2"
+    std::string get_full_name() const {
+        std::string name = d_name;
+        for (auto& p : d_params) {
+            name += "/" + p.first + ":" + p.second;
+        }
+        return name;
+    }
+
+    // one benchmark per combination of the axis values, the last axis changes fastest
+    std::vector<benchmark_info> expand(size_t cpu) const {
+        std::vector<benchmark_info> runs(1, benchmark_info(d_name, d_func));
+        for (auto& a : d_axes) {
+            auto values = a.get_values();
+            if (a.get_name() == "threads" && values.empty()) {
+                for (size_t t = 1; t < cpu; t *= 2) {
+                    values.push_back(std::to_string(t));
+                }
+                values.push_back(std::to_string(std::max(cpu, size_t(1))));
+            }
+            std::vector<benchmark_info> next;
+            for (auto& run : runs) {
+                for (auto& v : values) {
+                    next.push_back(run);
+                    next.back().d_params.emplace_back(a.get_name(), v);
+                }
+            }
+            runs.swap(next);
+        }
+        return runs;
+    }
 };
 
 /*
@@ -149,6 +334,11 @@ public:
         benchmark_info info(name, func);
         registration::get_ptr()->register_benchmark(info);
     }
+    // edited section: parameterized benchmarks
+    auto_register(const std::string& name, std::vector<axis> axes, std::function<void(context*)> func) {
+        benchmark_info info(name, func, axes);
+        registration::get_ptr()->register_benchmark(info);
+    }
 };
 
 #define CONCAT(x, y) x ## y
@@ -158,6 +348,9 @@ public:
 // registration class.
 #define BENCHMARK(x, f) benchpress::auto_register CONCAT2(register_, __LINE__)((x), (f));
 
+// edited section: parameterized benchmarks, BENCHMARK_P(name, { axis, ... }, f)
+#define BENCHMARK_P(x, ...) benchpress::auto_register CONCAT2(register_, __LINE__)((x), __VA_ARGS__);
+
 /*
  * This function can be used to keep variables on the stack that would normally be optimised away
  * by the compiler, without introducing any additional instructions or changing the behaviour of
@@ -233,20 +426,475 @@ inline void clobber()
 
 #endif
 
+/*
+ * edited section: hardware counters
+ * Linux perf_event_open counters for every thread of the process. Threads alive when attach() is called get their own
+ * counters, threads started later inherit them from the thread that started them and are added up when they exit.
+ * Only user-space events are counted. When the kernel refuses (no perf support, perf_event_paranoid, containers)
+ * available() is false and the benchmarks run as before, without a message.
+ */
+struct counter {
+    enum id { cycles, instructions, cache_misses, llc_loads, branch_misses, count };
+};
+
+inline const char* counter_name(counter::id id) {
+    static const char* const names[] = { "cycles", "instructions", "cache_misses", "llc_loads", "branch_misses" };
+    return names[id];
+}
+
+typedef std::array<double, counter::count> counter_values;   // totals, negative when the counter is missing
+
+inline counter_values no_counters() {
+    counter_values values;
+    values.fill(-1);
+    return values;
+}
+
+#ifdef __linux__
+
+class perf_counters {
+    struct reading {
+        uint64_t value;
+        uint64_t enabled;
+        uint64_t running;
+    };
+    struct event {
+        int         fd;
+        counter::id id;
+        reading     base;
+    };
+
+    std::vector<event>                  d_events;
+    std::vector<pid_t>                  d_tids;
+    std::array<bool, counter::count>    d_supported;
+    bool                                d_available;
+
+    static int open_event(counter::id id, pid_t tid) {
+        perf_event_attr attr = perf_event_attr();
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        switch (id) {
+            case counter::cycles:        attr.config = PERF_COUNT_HW_CPU_CYCLES; break;
+            case counter::instructions:  attr.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+            case counter::cache_misses:  attr.config = PERF_COUNT_HW_CACHE_MISSES; break;
+            case counter::branch_misses: attr.config = PERF_COUNT_HW_BRANCH_MISSES; break;
+            default:
+                attr.type = PERF_TYPE_HW_CACHE;
+                attr.config = PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                              (PERF_COUNT_HW_CACHE_RESULT_ACCESS << 16);
+        }
+        attr.disabled = 1;
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        return static_cast<int>(syscall(SYS_perf_event_open, &attr, tid, -1, -1, PERF_FLAG_FD_CLOEXEC));
+    }
+
+    static reading read_event(int fd) {
+        reading r = reading();
+        if (::read(fd, &r, sizeof(r)) != sizeof(r)) {
+            r = reading();
+        }
+        return r;
+    }
+
+    void control(unsigned long request) {
+        for (auto& e : d_events) {
+            ioctl(e.fd, request, 0);
+        }
+    }
+
+    void open_thread(pid_t tid) {
+        d_tids.push_back(tid);
+        for (int i = 0; i < counter::count; ++i) {
+            if (!d_supported[i]) continue;
+            int fd = open_event(counter::id(i), tid);
+            if (fd >= 0) {
+                d_events.push_back({fd, counter::id(i), reading()});
+            }
+        }
+    }
+
+public:
+    perf_counters()
+        : d_available(false)
+    {
+        // the calling thread decides which events the machine has
+        pid_t self = static_cast<pid_t>(syscall(SYS_gettid));
+        for (int i = 0; i < counter::count; ++i) {
+            int fd = open_event(counter::id(i), self);
+            d_supported[i] = fd >= 0;
+            if (fd >= 0) {
+                d_events.push_back({fd, counter::id(i), reading()});
+            }
+        }
+        d_available = d_supported[counter::cycles];
+        d_tids.push_back(self);
+    }
+
+    ~perf_counters() {
+        for (auto& e : d_events) {
+            close(e.fd);
+        }
+    }
+
+    perf_counters(const perf_counters&) = delete;
+    perf_counters& operator=(const perf_counters&) = delete;
+
+    bool available() const { return d_available; }
+
+    // opens counters for threads started since the last call, thread pools created by the benchmark included
+    void attach() {
+        DIR* dir = opendir("/proc/self/task");
+        if (dir == nullptr) return;
+        while (dirent* entry = readdir(dir)) {
+            pid_t tid = static_cast<pid_t>(std::atoi(entry->d_name));
+            if (tid > 0 && std::find(d_tids.begin(), d_tids.end(), tid) == d_tids.end()) {
+                open_thread(tid);
+            }
+        }
+        closedir(dir);
+    }
+
+    void enable() { control(PERF_EVENT_IOC_ENABLE); }
+    void disable() { control(PERF_EVENT_IOC_DISABLE); }
+
+    void reset() {
+        for (auto& e : d_events) {
+            e.base = read_event(e.fd);
+        }
+    }
+
+    // counts since reset(), scaled up when the kernel had to multiplex the counters
+    counter_values read() const {
+        counter_values values = no_counters();
+        for (auto& e : d_events) {
+            reading r = read_event(e.fd);
+            double running = double(r.running - e.base.running);
+            double enabled = double(r.enabled - e.base.enabled);
+            double value = double(r.value - e.base.value);
+            if (values[e.id] < 0) values[e.id] = 0;
+            if (running > 0) values[e.id] += value * enabled / running;
+        }
+        return values;
+    }
+};
+
+#else
+
+class perf_counters {
+public:
+    bool available() const { return false; }
+    void attach() {}
+    void enable() {}
+    void disable() {}
+    void reset() {}
+    counter_values read() const { return no_counters(); }
+};
+
+#endif
+
+/*
+ * edited section: allocation tracking
+ * Defining BENCHPRESS_TRACK_ALLOCATIONS before including benchpress replaces the global operator new and delete with
+ * versions that count the allocations of every thread while a tracked benchmark has its timer running. Without it, or
+ * without options::allocations, nothing is counted. Peak RSS is the high-water mark of the process, on Linux it is
+ * reset before each benchmark so every benchmark gets its own.
+ */
+struct allocation_counts {
+    double allocations = -1;   // totals, negative when not tracked
+    double bytes = -1;
+    double peak_rss_kb = -1;   // growth of the peak over the resident size at the start
+};
+
+struct allocation_tracker {
+    std::atomic<bool>   on{false};
+    std::atomic<size_t> allocations{0};
+    std::atomic<size_t> bytes{0};
+
+    void record(size_t size) {
+        if (on.load(std::memory_order_relaxed)) {
+            allocations.fetch_add(1, std::memory_order_relaxed);
+            bytes.fetch_add(size, std::memory_order_relaxed);
+        }
+    }
+    void reset() {
+        allocations = 0;
+        bytes = 0;
+    }
+};
+
+allocation_tracker allocations;
+
+#ifdef BENCHPRESS_TRACK_ALLOCATIONS
+const bool can_track_allocations = true;
+#else
+const bool can_track_allocations = false;
+#endif
+
+// in kB, field is VmRSS or VmHWM, 0 when unknown
+inline double resident_kb(const char* field) {
+#ifdef __linux__
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, std::strlen(field), field) == 0 && line[std::strlen(field)] == ':') {
+            return std::atof(line.c_str() + std::strlen(field) + 1);
+        }
+    }
+    return 0;
+#else
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return double(usage.ru_maxrss);
+#endif
+}
+
+inline void reset_peak_rss() {
+#ifdef __linux__
+    std::ofstream("/proc/self/clear_refs") << "5";
+#endif
+}
+
+/*
+ * edited section: sampling profiler
+ * Samples the call stacks of every thread of the process with SIGPROF from setitimer(ITIMER_PROF), the kernel sends
+ * it to the thread that used the cpu time, so the threads the benchmark starts are sampled too. Only stacks taken
+ * while the timer of a benchmark runs are kept. The signal handler only unwinds into a preallocated buffer, the
+ * stacks are symbolized with dladdr afterwards, so the binary should be linked with -rdynamic.
+ *
+ * Folded stacks are "root;caller;callee count" lines, as read by flamegraph.pl and speedscope.
+ */
+typedef std::map<std::string, size_t> folded_stacks;
+
+#ifdef BENCHPRESS_CAN_PROFILE
+
+class profiler {
+    static const int max_depth = 64;
+    static const int skipped = 2;   // the handler and the signal trampoline
+
+    struct stack {
+        std::atomic<int> depth;     // written last, 0 while the frames are filled in
+        void*            frames[max_depth];
+    };
+
+    std::unique_ptr<stack[]>    d_stacks;
+    size_t                      d_capacity;
+    std::atomic<size_t>         d_count;
+    std::atomic<bool>           d_on;
+    size_t                      d_rate;
+    std::map<void*, std::string> d_symbols;
+
+    static std::atomic<profiler*>& active() {
+        static std::atomic<profiler*> instance(nullptr);
+        return instance;
+    }
+
+    static void handle(int) {
+        profiler* p = active().load(std::memory_order_relaxed);
+        if (p == nullptr || !p->d_on.load(std::memory_order_relaxed)) return;
+        size_t i = p->d_count.fetch_add(1, std::memory_order_relaxed);
+        if (i >= p->d_capacity) return;
+        auto& s = p->d_stacks[i];
+        int depth = backtrace(s.frames, max_depth);
+        s.depth.store(depth, std::memory_order_release);
+    }
+
+    void set_timer(size_t rate) {
+        itimerval timer = itimerval();
+        if (rate > 0) {
+            timer.it_interval.tv_usec = static_cast<suseconds_t>(std::max<size_t>(1000000 / rate, 1));
+            timer.it_value = timer.it_interval;
+        }
+        setitimer(ITIMER_PROF, &timer, nullptr);
+    }
+
+    const std::string& symbol(void* address) {
+        auto it = d_symbols.find(address);
+        if (it != d_symbols.end()) return it->second;
+
+        std::string name;
+        Dl_info info = Dl_info();
+        bool found = dladdr(address, &info) != 0;
+        if (found && info.dli_sname != nullptr) {
+            int status = 0;
+            char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+            name = status == 0 && demangled != nullptr ? demangled : info.dli_sname;
+            std::free(demangled);
+        } else {
+            std::stringstream tmp;
+            // no exported symbol, the offset in the binary still works with addr2line
+            if (found && info.dli_fname != nullptr) {
+                tmp << info.dli_fname << "+0x" << std::hex
+                    << static_cast<char*>(address) - static_cast<char*>(info.dli_fbase);
+            } else {
+                tmp << address;
+            }
+            name = tmp.str();
+        }
+        std::replace(name.begin(), name.end(), ';', ',');
+        return d_symbols[address] = name;
+    }
+
+public:
+    profiler(size_t rate, size_t capacity = 1 << 15)
+        : d_stacks(new stack[capacity])
+        , d_capacity(capacity)
+        , d_count(0)
+        , d_on(false)
+        , d_rate(rate)
+    {
+        // the first backtrace loads the unwinder, that can't happen inside the handler
+        void* warm[1];
+        backtrace(warm, 1);
+        for (size_t i = 0; i < d_capacity; ++i) {
+            d_stacks[i].depth = 0;
+        }
+
+        struct sigaction action;
+        std::memset(&action, 0, sizeof(action));
+        action.sa_handler = &profiler::handle;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGPROF, &action, nullptr);
+        active() = this;
+        set_timer(d_rate);
+    }
+
+    ~profiler() {
+        set_timer(0);
+        active() = nullptr;
+        signal(SIGPROF, SIG_IGN);
+    }
+
+    profiler(const profiler&) = delete;
+    profiler& operator=(const profiler&) = delete;
+
+    void enable() { d_on = true; }
+    void disable() { d_on = false; }
+
+    // folds the stacks taken since the last call under root and starts over
+    folded_stacks collect(const std::string& root) {
+        disable();
+        folded_stacks folded;
+        size_t count = std::min(d_count.load(), d_capacity);
+        for (size_t i = 0; i < count; ++i) {
+            auto& s = d_stacks[i];
+            int depth = s.depth.load(std::memory_order_acquire);
+            std::string line = root;
+            std::replace(line.begin(), line.end(), ';', ',');
+            for (int k = depth - 1; k >= skipped; --k) {
+                // return addresses point after the call, one back is inside it
+                auto address = static_cast<char*>(s.frames[k]) - (k > skipped ? 1 : 0);
+                line += ";" + symbol(address);
+            }
+            if (depth > skipped) ++folded[line];
+            s.depth = 0;
+        }
+        if (d_count.load() > d_capacity) {
+            folded[root + ";[lost samples]"] += d_count.load() - d_capacity;
+        }
+        d_count = 0;
+        return folded;
+    }
+};
+
+#else
+
+class profiler {
+public:
+    profiler(size_t, size_t = 0) {}
+    void enable() {}
+    void disable() {}
+    folded_stacks collect(const std::string&) { return folded_stacks(); }
+};
+
+#endif
+
 /*
  * The result class is responsible for producing a printable string representation of a benchmark run.
+ *
+ * edited section: distributions
+ * Every sample is a separate timed run of the same number of iterations, the result keeps the ns/op of each one
+ * and summarises them with min, median, mean, p90, p99 and standard deviation.
  */
 class result {
+    std::string              d_name;
+    std::string              d_base_name;
+    params                   d_params;
+    size_t                   d_num_threads;
+    size_t                   d_size;
     size_t                   d_num_iterations;
     std::chrono::nanoseconds d_duration;
     size_t                   d_num_bytes;
+    std::vector<double>      d_samples;   // ns/op, sorted
+    counter_values           d_counters;  // edited section: hardware counters, totals over the samples
+    double                   d_flops;     // per op
+    allocation_counts        d_allocations;   // edited section: allocation tracking
+    size_t                   d_discarded;     // edited section: adaptive sampling, ramp samples left out
+    folded_stacks            d_profile;       // edited section: sampling profiler
 
 public:
-    result(size_t num_iterations, std::chrono::nanoseconds duration, size_t num_bytes)
-        : d_num_iterations(num_iterations)
+    result(const benchmark_info& info, size_t num_threads, size_t size, size_t num_iterations,
+           std::chrono::nanoseconds duration, size_t num_bytes, std::vector<double> samples)
+        : d_name(info.get_full_name())
+        , d_base_name(info.get_name())
+        , d_params(info.get_params())
+        , d_num_threads(num_threads)
+        , d_size(size)
+        , d_num_iterations(num_iterations)
         , d_duration(duration)
         , d_num_bytes(num_bytes)
-    {}
+        , d_samples(std::move(samples))
+        , d_counters(no_counters())
+        , d_flops(0)
+        , d_discarded(0)
+    {
+        std::sort(d_samples.begin(), d_samples.end());
+    }
+
+    // edited section: hardware counters
+    void set_counters(const counter_values& counters) { d_counters = counters; }
+    void set_flops(double flops) { d_flops = flops; }
+
+    // edited section: adaptive sampling
+    void set_discarded(size_t discarded) { d_discarded = discarded; }
+    size_t get_discarded() const { return d_discarded; }
+
+    // edited section: sampling profiler
+    void set_profile(folded_stacks profile) { d_profile = std::move(profile); }
+    const folded_stacks& get_profile() const { return d_profile; }
+
+    // edited section: allocation tracking
+    void set_allocations(const allocation_counts& allocations) { d_allocations = allocations; }
+    bool has_allocations() const { return d_allocations.allocations >= 0 && d_num_iterations > 0; }
+    double get_allocs_per_op() const { return has_allocations() ? d_allocations.allocations / d_num_iterations : -1; }
+    double get_bytes_per_op() const { return has_allocations() ? d_allocations.bytes / d_num_iterations : -1; }
+    double get_peak_rss_kb() const { return has_allocations() ? d_allocations.peak_rss_kb : -1; }
+
+    bool has_counter(counter::id id) const { return d_counters[id] >= 0 && d_num_iterations > 0; }
+    double get_per_op(counter::id id) const { return has_counter(id) ? d_counters[id] / d_num_iterations : -1; }
+
+    double get_ipc() const {
+        if (!has_counter(counter::cycles) || !has_counter(counter::instructions) || d_counters[counter::cycles] <= 0) {
+            return -1;
+        }
+        return d_counters[counter::instructions] / d_counters[counter::cycles];
+    }
+
+    // from the median sample, flop per ns is GFLOP/s
+    double get_gflops() const {
+        return d_flops > 0 && get_median() > 0 ? d_flops / get_median() : 0;
+    }
+
+    const std::string&         get_name() const { return d_name; }
+    const std::string&         get_base_name() const { return d_base_name; }
+    const params&              get_params() const { return d_params; }
+    size_t                     get_num_threads() const { return d_num_threads; }
+    size_t                     get_size() const { return d_size; }
+    size_t                     get_num_iterations() const { return d_num_iterations; }
+    const std::vector<double>& get_samples() const { return d_samples; }
 
     size_t get_ns_per_op() const {
         if (d_num_iterations <= 0) {
@@ -263,19 +911,701 @@ public:
                 double(std::chrono::duration_cast<std::chrono::seconds>(d_duration).count()));
     }
 
+    double get_min() const { return d_samples.empty() ? 0 : d_samples.front(); }
+    double get_median() const { return get_percentile(50); }
+
+    double get_mean() const {
+        if (d_samples.empty()) {
+            return 0;
+        }
+        double sum = 0;
+        for (auto x : d_samples) {
+            sum += x;
+        }
+        return sum / d_samples.size();
+    }
+
+    // linear interpolation between the closest ranks
+    double get_percentile(double p) const {
+        if (d_samples.empty()) {
+            return 0;
+        }
+        double rank = p / 100 * (d_samples.size() - 1);
+        size_t lo = static_cast<size_t>(std::floor(rank));
+        size_t hi = std::min(lo + 1, d_samples.size() - 1);
+        return d_samples[lo] + (rank - lo) * (d_samples[hi] - d_samples[lo]);
+    }
+
+    double get_stddev() const {
+        if (d_samples.size() < 2) {
+            return 0;
+        }
+        double mean = get_mean(), sum = 0;
+        for (auto x : d_samples) {
+            sum += (x - mean) * (x - mean);
+        }
+        return std::sqrt(sum / (d_samples.size() - 1));
+    }
+
     std::string to_string() const {
         std::stringstream tmp;
         tmp << std::setw(12) << std::right << d_num_iterations;
         size_t npo = get_ns_per_op();
         tmp << std::setw(12) << std::right << npo << std::setw(0) << " ns/op";
+        tmp << std::setw(12) << std::right << static_cast<size_t>(get_median()) << std::setw(0) << " median";
+        tmp << std::setw(12) << std::right << static_cast<size_t>(get_percentile(99)) << std::setw(0) << " p99";
+        tmp << std::setw(12) << std::right << static_cast<size_t>(get_stddev()) << std::setw(0) << " sd";
+        tmp << std::setw(4) << std::right << d_samples.size() << std::setw(0) << " samples";   // edited section: adaptive sampling
+        if (d_discarded > 0) {
+            tmp << " (" << d_discarded << " ramp)";
+        }
         double mbs = get_mb_per_s();
         if (mbs > 0.0) {
             tmp << std::setw(12) << std::right << mbs << std::setw(0) << " MB/s";
         }
+        // edited section: hardware counters
+        tmp << std::fixed << std::setprecision(2);
+        if (get_gflops() > 0) {
+            tmp << std::setw(8) << std::right << get_gflops() << std::setw(0) << " GFLOP/s";
+        }
+        if (get_ipc() >= 0) {
+            tmp << std::setw(6) << std::right << get_ipc() << std::setw(0) << " IPC";
+        }
+        tmp << std::setprecision(0);
+        if (has_counter(counter::cache_misses)) {
+            tmp << std::setw(10) << std::right << get_per_op(counter::cache_misses) << std::setw(0) << " miss/op";
+        }
+        if (has_counter(counter::llc_loads)) {
+            tmp << std::setw(10) << std::right << get_per_op(counter::llc_loads) << std::setw(0) << " llc/op";
+        }
+        if (has_counter(counter::branch_misses)) {
+            tmp << std::setw(10) << std::right << get_per_op(counter::branch_misses) << std::setw(0) << " br-miss/op";
+        }
+        // edited section: allocation tracking
+        if (has_allocations()) {
+            tmp << std::setprecision(1) << std::setw(10) << std::right << get_allocs_per_op() << std::setw(0) << " allocs/op"
+                << std::setprecision(0) << std::setw(10) << std::right << get_bytes_per_op() << std::setw(0) << " B/op"
+                << std::setw(8) << std::right << get_peak_rss_kb() << std::setw(0) << " kB rss";
+        }
         return std::string(tmp.str());
     }
 };
 
+/*
+ * edited section: complexity
+ * Fits median ns/op = c * size^k by least squares on the logs, over the runs of a benchmark that only differ in size.
+ */
+struct complexity {
+    std::string name;          // benchmark with every parameter but the size
+    double      exponent;
+    double      coefficient;
+    double      r2;
+    size_t      points;
+};
+
+typedef std::vector<std::pair<std::string, std::vector<const result*>>> result_groups;
+
+// runs that match in every parameter but the skipped ones, named after the rest, in the order they ran
+inline result_groups group_results(const std::vector<result>& results, std::initializer_list<std::string> skip,
+                                   std::function<bool(const result&)> keep) {
+    result_groups groups;
+    for (auto& r : results) {
+        if (!keep(r)) continue;
+        std::string key = r.get_base_name();
+        for (auto& p : r.get_params()) {
+            if (std::find(skip.begin(), skip.end(), p.first) == skip.end()) key += "/" + p.first + ":" + p.second;
+        }
+        auto it = std::find_if(groups.begin(), groups.end(), [&](const result_groups::value_type& g) {
+            return g.first == key;
+        });
+        if (it == groups.end()) {
+            groups.emplace_back(key, std::vector<const result*>());
+            it = groups.end() - 1;
+        }
+        it->second.push_back(&r);
+    }
+    return groups;
+}
+
+inline std::vector<complexity> fit_complexity(const std::vector<result>& results) {
+    auto groups = group_results(results, { "size" }, [](const result& r) {
+        return r.get_size() != 0 && r.get_median() > 0;
+    });
+
+    std::vector<complexity> fits;
+    for (auto& g : groups) {
+        double n = g.second.size(), sx = 0, sy = 0, sxx = 0, sxy = 0, syy = 0;
+        for (auto r : g.second) {
+            double x = std::log(double(r->get_size())), y = std::log(r->get_median());
+            sx += x; sy += y; sxx += x * x; sxy += x * y; syy += y * y;
+        }
+        double vx = n * sxx - sx * sx, vy = n * syy - sy * sy;
+        if (n < 2 || vx <= 0) continue;
+        double k = (n * sxy - sx * sy) / vx;
+        double r2 = vy > 0 ? (n * sxy - sx * sy) * (n * sxy - sx * sy) / (vx * vy) : 1;
+        fits.push_back({g.first, k, std::exp((sy - k * sx) / n), r2, size_t(n)});
+    }
+    return fits;
+}
+
+inline void write_complexity(std::ostream& out, const std::vector<complexity>& fits) {
+    for (auto& f : fits) {
+        out << std::setw(35) << std::left << f.name
+            << "  O(n^" << std::fixed << std::setprecision(2) << f.exponent << ")"
+            << "  r2 " << std::setprecision(3) << f.r2
+            << std::defaultfloat << "  over " << f.points << " sizes" << std::endl;
+    }
+}
+
+/*
+ * edited section: scaling
+ * Strong scaling compares the runs of a benchmark that only differ in threads: speedup T1 / Tp of the median and
+ * efficiency speedup / p. The serial fraction f is the least squares fit of Amdahl's law Tp / T1 = f + (1 - f) / p.
+ *
+ * Weak scaling needs benchmarks that grow the problem with the threads, they take a "work" parameter and set the size
+ * so that size^work_exponent / threads stays the same. Sizes are rounded, so the efficiency T1 / Tp is corrected by
+ * the work each run really had per thread. Speedup is the scaled one, p * efficiency.
+ */
+struct scaling_point {
+    size_t threads;
+    size_t size;
+    double median;
+    double speedup;
+    double efficiency;
+};
+
+struct scaling {
+    std::string                name;             // benchmark with every parameter but threads (and size when weak)
+    bool                       weak;
+    std::vector<scaling_point> points;
+    double                     serial_fraction;  // strong scaling only, negative without enough points
+};
+
+inline std::vector<scaling> fit_scaling(const std::vector<result>& results, double work_exponent = 3) {
+    auto has_work = [](const result& r) {
+        for (auto& p : r.get_params()) {
+            if (p.first == "work") return true;
+        }
+        return false;
+    };
+    auto strong = group_results(results, { "threads" }, [&](const result& r) { return r.get_median() > 0 && !has_work(r); });
+    auto weak = group_results(results, { "threads", "size" }, [&](const result& r) { return r.get_median() > 0 && has_work(r); });
+
+    std::vector<scaling> scalings;
+    for (int kind = 0; kind < 2; ++kind) {
+        for (auto& g : (kind == 0 ? strong : weak)) {
+            auto runs = g.second;
+            std::stable_sort(runs.begin(), runs.end(), [](const result* a, const result* b) {
+                return a->get_num_threads() < b->get_num_threads();
+            });
+            if (runs.size() < 2 || runs.front()->get_num_threads() != 1) continue;
+
+            auto base = runs.front();
+            scaling sc{g.first, kind == 1, {}, -1};
+            double sxx = 0, sxy = 0;
+            for (auto r : runs) {
+                double p = double(r->get_num_threads());
+                double ratio = r->get_median() / base->get_median();
+                scaling_point point{r->get_num_threads(), r->get_size(), r->get_median(), 0, 0};
+                if (sc.weak) {
+                    double work = base->get_size() > 0 && r->get_size() > 0
+                        ? std::pow(double(r->get_size()) / base->get_size(), work_exponent) / p : 1;
+                    point.efficiency = work / ratio;
+                    point.speedup = p * point.efficiency;
+                } else {
+                    point.speedup = 1 / ratio;
+                    point.efficiency = point.speedup / p;
+                    // Tp / T1 - 1 / p = f (1 - 1 / p)
+                    double x = 1 - 1 / p;
+                    sxx += x * x;
+                    sxy += x * (ratio - 1 / p);
+                }
+                sc.points.push_back(point);
+            }
+            if (!sc.weak && sxx > 0) {
+                sc.serial_fraction = std::max(0.0, std::min(1.0, sxy / sxx));
+            }
+            scalings.push_back(sc);
+        }
+    }
+    return scalings;
+}
+
+inline void write_scaling(std::ostream& out, const std::vector<scaling>& scalings) {
+    for (int kind = 0; kind < 2; ++kind) {
+        bool header = false;
+        for (auto& sc : scalings) {
+            if (sc.weak != (kind == 1)) continue;
+            if (!header) {
+                out << (kind == 0 ? "Strong scaling:" : "Weak scaling:") << std::endl;
+                out << std::setw(35) << std::left << "" << std::right << std::setw(8) << "threads" << std::setw(8) << "size"
+                    << std::setw(14) << "median ns" << std::setw(9) << "speedup" << std::setw(11) << "efficiency" << std::endl;
+                header = true;
+            }
+            out << std::left << sc.name;
+            if (sc.serial_fraction >= 0) {
+                out << "  (serial fraction " << std::fixed << std::setprecision(3) << sc.serial_fraction << std::defaultfloat << ")";
+            }
+            out << std::endl;
+            for (auto& p : sc.points) {
+                out << std::setw(35) << "" << std::right << std::setw(8) << p.threads << std::setw(8) << p.size
+                    << std::setw(14) << static_cast<size_t>(p.median) << std::fixed << std::setprecision(2)
+                    << std::setw(9) << p.speedup << std::setw(11) << p.efficiency << std::defaultfloat << std::endl;
+            }
+        }
+        if (header) out << std::endl;
+    }
+}
+
+/*
+ * edited section: machine-readable output
+ * What the benchmarks were built with, BENCHPRESS_BUILD_FLAGS is passed by the Makefile.
+ */
+#ifndef BENCHPRESS_BUILD_FLAGS
+#define BENCHPRESS_BUILD_FLAGS ""
+#endif
+
+inline std::map<std::string, std::string> build_info() {
+    std::map<std::string, std::string> info;
+#if defined(__clang__)
+    info["compiler"] = std::string("clang ") + __clang_version__;
+#elif defined(__GNUC__)
+    info["compiler"] = std::string("gcc ") + __VERSION__;
+#elif defined(_MSC_VER)
+    info["compiler"] = "msvc " + std::to_string(_MSC_VER);
+#endif
+    info["flags"] = BENCHPRESS_BUILD_FLAGS;
+    info["date"] = std::string(__DATE__) + " " + __TIME__;
+    info["cpus"] = std::to_string(std::thread::hardware_concurrency());
+#ifdef NDEBUG
+    info["assertions"] = "off";
+#else
+    info["assertions"] = "on";
+#endif
+    return info;
+}
+
+inline std::string json_escape(const std::string& s) {
+    std::stringstream tmp;
+    for (auto c : s) {
+        switch (c) {
+            case '"':  tmp << "\\\""; break;
+            case '\\': tmp << "\\\\"; break;
+            case '\n': tmp << "\\n"; break;
+            case '\t': tmp << "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    tmp << "\\u" << std::hex << std::setw(4) << std::setfill('0') << int(c) << std::dec << std::setfill(' ');
+                } else {
+                    tmp << c;
+                }
+        }
+    }
+    return tmp.str();
+}
+
+inline std::string csv_escape(const std::string& s) {
+    if (s.find_first_of(",\"\n") == std::string::npos) {
+        return s;
+    }
+    std::string tmp = "\"";
+    for (auto c : s) {
+        tmp += c;
+        if (c == '"') tmp += c;
+    }
+    return tmp + "\"";
+}
+
+inline void write_json(std::ostream& out, const std::vector<result>& results) {
+    auto info = build_info();
+    out << std::setprecision(12);
+    out << "{\n  \"build\": {";
+    for (auto it = info.begin(); it != info.end(); ++it) {
+        out << (it == info.begin() ? "\n" : ",\n") << "    \"" << it->first << "\": \"" << json_escape(it->second) << "\"";
+    }
+    out << "\n  },\n  \"benchmarks\": [";
+    for (size_t i = 0; i < results.size(); ++i) {
+        auto& r = results[i];
+        out << (i == 0 ? "\n" : ",\n") << "    {";
+        out << "\"name\": \"" << json_escape(r.get_name()) << "\", ";
+        out << "\"params\": {";
+        for (size_t k = 0; k < r.get_params().size(); ++k) {
+            auto& p = r.get_params()[k];
+            out << (k == 0 ? "" : ", ") << "\"" << json_escape(p.first) << "\": \"" << json_escape(p.second) << "\"";
+        }
+        out << "}, ";
+        out << "\"threads\": " << r.get_num_threads() << ", ";
+        out << "\"size\": " << r.get_size() << ", ";
+        out << "\"iterations\": " << r.get_num_iterations() << ", ";
+        out << "\"min_ns\": " << r.get_min() << ", ";
+        out << "\"median_ns\": " << r.get_median() << ", ";
+        out << "\"mean_ns\": " << r.get_mean() << ", ";
+        out << "\"p90_ns\": " << r.get_percentile(90) << ", ";
+        out << "\"p99_ns\": " << r.get_percentile(99) << ", ";
+        out << "\"stddev_ns\": " << r.get_stddev() << ", ";
+        out << "\"discarded\": " << r.get_discarded() << ", ";
+        if (r.get_gflops() > 0) {
+            out << "\"gflops\": " << r.get_gflops() << ", ";
+        }
+        if (r.has_counter(counter::cycles)) {
+            out << "\"counters_per_op\": {";
+            for (int c = 0, k = 0; c < counter::count; ++c) {
+                if (!r.has_counter(counter::id(c))) continue;
+                out << (k++ == 0 ? "" : ", ") << "\"" << counter_name(counter::id(c)) << "\": " << r.get_per_op(counter::id(c));
+            }
+            out << "}, \"ipc\": " << r.get_ipc() << ", ";
+        }
+        if (r.has_allocations()) {   // edited section: allocation tracking
+            out << "\"allocs_per_op\": " << r.get_allocs_per_op() << ", ";
+            out << "\"bytes_per_op\": " << r.get_bytes_per_op() << ", ";
+            out << "\"peak_rss_delta_kb\": " << r.get_peak_rss_kb() << ", ";
+        }
+        out << "\"samples_ns\": [";
+        for (size_t k = 0; k < r.get_samples().size(); ++k) {
+            out << (k == 0 ? "" : ", ") << r.get_samples()[k];
+        }
+        out << "]}";
+    }
+    out << "\n  ],\n  \"complexity\": [";
+    auto fits = fit_complexity(results);
+    for (size_t i = 0; i < fits.size(); ++i) {
+        out << (i == 0 ? "\n" : ",\n") << "    {";
+        out << "\"name\": \"" << json_escape(fits[i].name) << "\", ";
+        out << "\"exponent\": " << fits[i].exponent << ", ";
+        out << "\"coefficient\": " << fits[i].coefficient << ", ";
+        out << "\"r2\": " << fits[i].r2 << ", ";
+        out << "\"points\": " << fits[i].points << "}";
+    }
+    out << "\n  ],\n  \"scaling\": [";   // edited section: scaling
+    auto scalings = fit_scaling(results);
+    for (size_t i = 0; i < scalings.size(); ++i) {
+        auto& sc = scalings[i];
+        out << (i == 0 ? "\n" : ",\n") << "    {";
+        out << "\"name\": \"" << json_escape(sc.name) << "\", ";
+        out << "\"kind\": \"" << (sc.weak ? "weak" : "strong") << "\", ";
+        if (sc.serial_fraction >= 0) {
+            out << "\"serial_fraction\": " << sc.serial_fraction << ", ";
+        }
+        out << "\"points\": [";
+        for (size_t k = 0; k < sc.points.size(); ++k) {
+            auto& p = sc.points[k];
+            out << (k == 0 ? "" : ", ") << "{\"threads\": " << p.threads << ", \"size\": " << p.size
+                << ", \"median_ns\": " << p.median << ", \"speedup\": " << p.speedup << ", \"efficiency\": " << p.efficiency << "}";
+        }
+        out << "]}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+inline void write_csv(std::ostream& out, const std::vector<result>& results) {
+    auto info = build_info();
+    out << std::setprecision(12);
+    out << "name,benchmark,params,threads,size,iterations,samples,min_ns,median_ns,mean_ns,p90_ns,p99_ns,stddev_ns,discarded,gflops,ipc";
+    for (int c = 0; c < counter::count; ++c) {
+        out << "," << counter_name(counter::id(c)) << "_per_op";
+    }
+    out << ",allocs_per_op,bytes_per_op,peak_rss_delta_kb,compiler,flags\n";
+    for (auto& r : results) {
+        std::string ps;
+        for (auto& p : r.get_params()) {
+            ps += (ps.empty() ? "" : ";") + p.first + "=" + p.second;
+        }
+        out << csv_escape(r.get_name()) << "," << csv_escape(r.get_base_name()) << "," << csv_escape(ps) << "," << r.get_num_threads() << "," << r.get_size() << ","
+            << r.get_num_iterations() << "," << r.get_samples().size() << ","
+            << r.get_min() << "," << r.get_median() << "," << r.get_mean() << ","
+            << r.get_percentile(90) << "," << r.get_percentile(99) << "," << r.get_stddev() << "," << r.get_discarded() << ",";
+        // edited section: hardware counters, empty when missing
+        if (r.get_gflops() > 0) out << r.get_gflops();
+        out << ",";
+        if (r.get_ipc() >= 0) out << r.get_ipc();
+        for (int c = 0; c < counter::count; ++c) {
+            out << ",";
+            if (r.has_counter(counter::id(c))) out << r.get_per_op(counter::id(c));
+        }
+        out << ",";
+        if (r.has_allocations()) {
+            out << r.get_allocs_per_op() << "," << r.get_bytes_per_op() << "," << r.get_peak_rss_kb();
+        } else {
+            out << ",,";
+        }
+        out << "," << csv_escape(info["compiler"]) << "," << csv_escape(info["flags"]) << "\n";
+    }
+}
+
+// edited section: sampling profiler, every benchmark is the root frame of its own stacks
+inline void write_profile(std::ostream& out, const std::vector<result>& results) {
+    for (auto& r : results) {
+        for (auto& stack : r.get_profile()) {
+            out << stack.first << " " << stack.second << "\n";
+        }
+    }
+}
+
+/*
+ * edited section: regression gate
+ * A small reader for the json written by write_json, enough to load a baseline back. Throws std::runtime_error on
+ * anything it can't parse.
+ */
+class json {
+public:
+    enum kind { null, boolean, number, string, array, object };
+
+    kind                                      d_kind = null;
+    double                                    d_number = 0;
+    std::string                               d_string;
+    std::vector<json>                         d_items;
+    std::vector<std::pair<std::string, json>> d_members;
+
+    const json* find(const std::string& key) const {
+        for (auto& m : d_members) {
+            if (m.first == key) return &m.second;
+        }
+        return nullptr;
+    }
+
+    static json parse(std::istream& in) {
+        std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        size_t pos = 0;
+        json value = parse_value(text, pos);
+        skip_space(text, pos);
+        if (pos != text.size()) fail("trailing characters", pos);
+        return value;
+    }
+
+private:
+    static void fail(const std::string& what, size_t pos) {
+        throw std::runtime_error("json: " + what + " at " + std::to_string(pos));
+    }
+
+    static void skip_space(const std::string& text, size_t& pos) {
+        while (pos < text.size() && std::isspace(static_cast<unsigned char>(text[pos]))) ++pos;
+    }
+
+    static void expect(const std::string& text, size_t& pos, char c) {
+        skip_space(text, pos);
+        if (pos >= text.size() || text[pos] != c) fail(std::string("expected '") + c + "'", pos);
+        ++pos;
+    }
+
+    static std::string parse_string(const std::string& text, size_t& pos) {
+        expect(text, pos, '"');
+        std::string value;
+        while (pos < text.size() && text[pos] != '"') {
+            char c = text[pos++];
+            if (c == '\\' && pos < text.size()) {
+                c = text[pos++];
+                switch (c) {
+                    case 'n': value += '\n'; break;
+                    case 't': value += '\t'; break;
+                    case 'r': value += '\r'; break;
+                    case 'b': value += '\b'; break;
+                    case 'f': value += '\f'; break;
+                    case 'u':
+                        // write_json only escapes control characters this way
+                        if (pos + 4 > text.size()) fail("bad escape", pos);
+                        value += static_cast<char>(std::stoi(text.substr(pos, 4), nullptr, 16));
+                        pos += 4;
+                        break;
+                    default: value += c;
+                }
+            } else {
+                value += c;
+            }
+        }
+        if (pos >= text.size()) fail("unterminated string", pos);
+        ++pos;
+        return value;
+    }
+
+    static json parse_value(const std::string& text, size_t& pos) {
+        skip_space(text, pos);
+        if (pos >= text.size()) fail("unexpected end", pos);
+        json value;
+        char c = text[pos];
+        if (c == '{') {
+            value.d_kind = object;
+            ++pos;
+            skip_space(text, pos);
+            if (pos < text.size() && text[pos] == '}') { ++pos; return value; }
+            do {
+                std::string key = parse_string(text, pos);
+                expect(text, pos, ':');
+                value.d_members.emplace_back(key, parse_value(text, pos));
+                skip_space(text, pos);
+            } while (pos < text.size() && text[pos] == ',' && ++pos);
+            expect(text, pos, '}');
+        } else if (c == '[') {
+            value.d_kind = array;
+            ++pos;
+            skip_space(text, pos);
+            if (pos < text.size() && text[pos] == ']') { ++pos; return value; }
+            do {
+                value.d_items.push_back(parse_value(text, pos));
+                skip_space(text, pos);
+            } while (pos < text.size() && text[pos] == ',' && ++pos);
+            expect(text, pos, ']');
+        } else if (c == '"') {
+            value.d_kind = string;
+            value.d_string = parse_string(text, pos);
+        } else if (text.compare(pos, 4, "true") == 0 || text.compare(pos, 5, "false") == 0) {
+            value.d_kind = boolean;
+            value.d_number = c == 't';
+            pos += c == 't' ? 4 : 5;
+        } else if (text.compare(pos, 4, "null") == 0) {
+            pos += 4;
+        } else {
+            const char* begin = text.c_str() + pos;
+            char* end = nullptr;
+            value.d_kind = number;
+            value.d_number = std::strtod(begin, &end);
+            if (end == begin) fail("unexpected character", pos);
+            pos += end - begin;
+        }
+        return value;
+    }
+};
+
+/*
+ * Mann-Whitney U test of "current is slower than baseline", one-sided p-value. Exact for small samples without ties,
+ * from the q-binomial counts of U, otherwise the normal approximation with tie and continuity correction.
+ */
+inline double mann_whitney(const std::vector<double>& baseline, const std::vector<double>& current) {
+    size_t n1 = baseline.size(), n2 = current.size();
+    if (n1 == 0 || n2 == 0) {
+        return 1;
+    }
+
+    std::vector<std::pair<double, int>> all;
+    for (auto x : baseline) all.emplace_back(x, 0);
+    for (auto x : current) all.emplace_back(x, 1);
+    std::sort(all.begin(), all.end());
+
+    // midranks, ties share the average rank
+    double rank_sum = 0, ties = 0;
+    bool tied = false;
+    for (size_t i = 0; i < all.size();) {
+        size_t j = i;
+        while (j < all.size() && all[j].first == all[i].first) ++j;
+        double t = double(j - i);
+        for (size_t k = i; k < j; ++k) {
+            if (all[k].second == 1) rank_sum += (i + j + 1) / 2.0;
+        }
+        ties += t * t * t - t;
+        tied = tied || t > 1;
+        i = j;
+    }
+    double u = rank_sum - n2 * (n2 + 1) / 2.0;   // pairs where current is slower
+
+    if (!tied && n1 + n2 <= 60) {
+        // coefficients of [n1 + n2 choose n1]_q, the number of orderings with each U
+        std::vector<double> counts(n1 * n2 + 1, 0);
+        counts[0] = 1;
+        for (size_t k = 1; k <= n1; ++k) {
+            for (size_t i = counts.size() - 1; i >= n2 + k; --i) counts[i] -= counts[i - n2 - k];
+            for (size_t i = k; i < counts.size(); ++i) counts[i] += counts[i - k];
+        }
+        double total = 0, tail = 0;
+        for (size_t i = 0; i < counts.size(); ++i) {
+            total += counts[i];
+            if (double(i) >= u) tail += counts[i];
+        }
+        return tail / total;
+    }
+
+    double n = double(n1 + n2);
+    double mean = n1 * n2 / 2.0;
+    double variance = n1 * n2 / 12.0 * ((n + 1) - ties / (n * (n - 1)));
+    if (variance <= 0) {
+        return u > mean ? 0 : 1;
+    }
+    double z = (u - mean - 0.5) / std::sqrt(variance);
+    return 0.5 * std::erfc(z / std::sqrt(2.0));
+}
+
+struct comparison {
+    enum verdict { same, faster, slower, added, removed };
+
+    std::string name;
+    double      baseline;   // median ns/op, 0 when missing
+    double      current;
+    double      change;     // current / baseline - 1
+    double      p_value;    // of the slowdown
+    verdict     result;
+};
+
+/*
+ * Compares runs by full name. A run is slower when the test rejects "not slower" at alpha and the median grew by more
+ * than threshold, faster the same way in the other direction. Benchmarks present on one side only are listed too.
+ */
+inline std::vector<comparison> compare_baseline(std::istream& baseline, const std::vector<result>& results,
+                                                double alpha = 0.05, double threshold = 0.05) {
+    json root = json::parse(baseline);
+    const json* benchmarks = root.find("benchmarks");
+    if (benchmarks == nullptr || benchmarks->d_kind != json::array) {
+        throw std::runtime_error("json: no benchmarks in the baseline");
+    }
+
+    std::vector<std::pair<std::string, std::vector<double>>> base;
+    for (auto& b : benchmarks->d_items) {
+        const json* name = b.find("name");
+        const json* samples = b.find("samples_ns");
+        if (name == nullptr || samples == nullptr) continue;
+        std::vector<double> values;
+        for (auto& x : samples->d_items) values.push_back(x.d_number);
+        base.emplace_back(name->d_string, values);
+    }
+
+    auto median = [](std::vector<double> v) {
+        if (v.empty()) return 0.0;
+        std::sort(v.begin(), v.end());
+        return v.size() % 2 ? v[v.size() / 2] : (v[v.size() / 2 - 1] + v[v.size() / 2]) / 2;
+    };
+
+    std::vector<comparison> comparisons;
+    for (auto& r : results) {
+        auto it = std::find_if(base.begin(), base.end(), [&](const std::pair<std::string, std::vector<double>>& b) {
+            return b.first == r.get_name();
+        });
+        if (it == base.end()) {
+            comparisons.push_back({r.get_name(), 0, r.get_median(), 0, 1, comparison::added});
+            continue;
+        }
+        comparison c{r.get_name(), median(it->second), r.get_median(), 0, 1, comparison::same};
+        c.change = c.baseline > 0 ? c.current / c.baseline - 1 : 0;
+        c.p_value = mann_whitney(it->second, r.get_samples());
+        if (c.p_value < alpha && c.change > threshold) {
+            c.result = comparison::slower;
+        } else if (mann_whitney(r.get_samples(), it->second) < alpha && -c.change > threshold) {
+            c.result = comparison::faster;
+        }
+        comparisons.push_back(c);
+    }
+    for (auto& b : base) {
+        bool ran = std::any_of(results.begin(), results.end(), [&](const result& r) { return r.get_name() == b.first; });
+        if (!ran) comparisons.push_back({b.first, median(b.second), 0, 0, 1, comparison::removed});
+    }
+    return comparisons;
+}
+
+inline bool has_regressions(const std::vector<comparison>& comparisons) {
+    return std::any_of(comparisons.begin(), comparisons.end(), [](const comparison& c) {
+        return c.result == comparison::slower;
+    });
+}
+
+inline void write_comparison(std::ostream& out, const std::vector<comparison>& comparisons) {
+    static const char* const verdicts[] = { "", "faster", "SLOWER", "new", "missing" };
+    out << std::setw(35) << std::left << "" << std::right << std::setw(14) << "baseline ns" << std::setw(14) << "current ns"
+        << std::setw(10) << "change" << std::setw(10) << "p" << std::endl;
+    for (auto& c : comparisons) {
+        out << std::setw(35) << std::left << c.name << std::right
+            << std::setw(14) << static_cast<size_t>(c.baseline) << std::setw(14) << static_cast<size_t>(c.current)
+            << std::fixed << std::setprecision(1) << std::showpos << std::setw(9) << c.change * 100 << "%" << std::noshowpos
+            << std::setprecision(3) << std::setw(10) << c.p_value << std::defaultfloat
+            << "  " << verdicts[c.result] << std::endl;
+    }
+}
+
 /*
  * The parallel_context class is responsible for providing a thread-safe context for parallel benchmark code.
  */
@@ -298,31 +1628,143 @@ class context {
     bool                                           d_timer_on;
     std::chrono::high_resolution_clock::time_point d_start;
     std::chrono::nanoseconds                       d_duration;
-    std::chrono::seconds                           d_benchtime;
+    std::chrono::nanoseconds                       d_benchtime;   // edited section: per sample
+    std::chrono::nanoseconds                       d_budget;      // edited section: adaptive sampling, per benchmark
+    std::chrono::nanoseconds                       d_warmup;
+    size_t                                         d_min_samples;
+    double                                         d_confidence;
     size_t                                         d_num_iterations;
     size_t                                         d_num_threads;
     size_t                                         d_num_bytes;
+    size_t                                         d_num_samples;
+    size_t                                         d_size;
     benchmark_info                                 d_benchmark;
+    std::map<std::string, std::shared_ptr<void>>   d_fixtures;    // edited section: fixtures
+    std::vector<std::function<void()>>             d_teardowns;
+    std::unique_ptr<perf_counters>                 d_counters;    // edited section: hardware counters
+    double                                         d_flops;
+    bool                                           d_track_allocations;   // edited section: allocation tracking
+    profiler*                                      d_profiler;    // edited section: sampling profiler
 
 public:
     context(const benchmark_info& info, const options& opts)
         : d_timer_on(false)
         , d_start()
         , d_duration()
-        , d_benchtime(std::chrono::seconds(opts.get_benchtime()))
+        , d_benchtime(std::chrono::nanoseconds(std::chrono::seconds(opts.get_benchtime())) / opts.get_samples())
+        , d_budget(std::chrono::seconds(opts.get_benchtime()))
+        , d_warmup(static_cast<long long>(opts.get_warmup() * 1e9))
+        , d_min_samples(opts.get_min_samples())
+        , d_confidence(opts.get_confidence())
         , d_num_iterations(1)
         , d_num_threads(opts.get_cpu())
         , d_num_bytes(0)
+        , d_num_samples(opts.get_samples())
+        , d_size(0)
         , d_benchmark(info)
-    {}
+        , d_flops(0)
+        , d_track_allocations(can_track_allocations && opts.get_allocations())
+        , d_profiler(nullptr)
+    {
+        // edited section: hardware counters, dropped when the kernel doesn't give any
+        if (opts.get_counters()) {
+            d_counters.reset(new perf_counters());
+            if (!d_counters->available()) d_counters.reset();
+        }
+
+        // edited section: parameterized benchmarks
+        if (has_param("threads")) d_num_threads = param_int("threads");
+        if (has_param("size")) d_size = param_int("size");
+    }
 
     size_t num_iterations() const { return d_num_iterations; }
 
+    // edited section: the problem size reported with the results
+    void set_size(size_t n) { d_size = n; }
+    size_t size() const { return d_size; }
+
+    // edited section: parameterized benchmarks
+    bool has_param(const std::string& name) const {
+        for (auto& p : d_benchmark.get_params()) {
+            if (p.first == name) return true;
+        }
+        return false;
+    }
+    std::string param(const std::string& name) const {
+        for (auto& p : d_benchmark.get_params()) {
+            if (p.first == name) return p.second;
+        }
+        return std::string();
+    }
+    long long param_int(const std::string& name) const {
+        return has_param(name) ? std::stoll(param(name)) : 0;
+    }
+
+    /*
+     * edited section: fixtures
+     * A named value built on the first call, with the timer stopped, and kept for every later run of the same
+     * benchmark. The teardown runs untimed after the last sample.
+     *
+     * auto& M = ctx->fixture<Matrix>("input", [&]() { return make_input(ctx->size()); });
+     */
+    template<typename T>
+    T& fixture(const std::string& name, std::function<T()> setup, std::function<void(T&)> teardown = nullptr) {
+        auto it = d_fixtures.find(name);
+        if (it != d_fixtures.end()) {
+            return *static_cast<T*>(it->second.get());
+        }
+        bool was_on = d_timer_on;
+        stop_timer();
+        auto value = std::make_shared<T>(setup());
+        d_fixtures[name] = value;
+        if (teardown) {
+            d_teardowns.push_back([value, teardown]() { teardown(*value); });
+        }
+        if (was_on) start_timer();
+        return *value;
+    }
+
+    // count inputs built once per benchmark, untimed, so iterations can cycle through different data
+    template<typename T>
+    std::vector<T>& pool(const std::string& name, size_t count, std::function<T(size_t)> make) {
+        return fixture<std::vector<T>>(name, [&]() {
+            std::vector<T> inputs;
+            inputs.reserve(count);
+            for (size_t i = 0; i < count; ++i) {
+                inputs.push_back(make(i));
+            }
+            return inputs;
+        });
+    }
+
+    // runs body for every iteration, setup and teardown around each one are not timed
+    void each_iteration(std::function<void(size_t)> body,
+                        std::function<void(size_t)> setup = nullptr,
+                        std::function<void(size_t)> teardown = nullptr) {
+        for (size_t i = 0; i < d_num_iterations; ++i) {
+            if (setup) {
+                stop_timer();
+                setup(i);
+                start_timer();
+            }
+            body(i);
+            if (teardown) {
+                stop_timer();
+                teardown(i);
+                start_timer();
+            }
+        }
+    }
+
     void set_num_threads(size_t n) { d_num_threads = n; }
     size_t num_threads() const { return d_num_threads; }
 
+    // edited section: hardware counters, they only count while the timer runs
     void start_timer() {
         if (!d_timer_on) {
+            if (d_counters) d_counters->enable();
+            if (d_track_allocations) allocations.on = true;
+            if (d_profiler) d_profiler->enable();
             d_start = std::chrono::high_resolution_clock::now();
             d_timer_on = true;
         }
@@ -330,10 +1772,15 @@ public:
     void stop_timer() {
         if (d_timer_on) {
             d_duration += std::chrono::high_resolution_clock::now() - d_start;
+            if (d_counters) d_counters->disable();
+            if (d_track_allocations) allocations.on = false;
+            if (d_profiler) d_profiler->disable();
             d_timer_on = false;
         }
     }
     void reset_timer() {
+        if (d_counters) d_counters->reset();
+        if (d_track_allocations) allocations.reset();
         if (d_timer_on) {
             d_start = std::chrono::high_resolution_clock::now();
         }
@@ -342,6 +1789,18 @@ public:
 
     void set_bytes(int64_t bytes) { d_num_bytes = bytes; }
 
+    // edited section: sampling profiler, stacks are only taken while the timer runs
+    void set_profiler(profiler* p) { d_profiler = p; }
+
+    // edited section: adaptive sampling, seconds this benchmark may take instead of the benchtime option
+    void set_budget(double seconds) {
+        d_budget = std::chrono::nanoseconds(static_cast<long long>(seconds * 1e9));
+        d_benchtime = d_budget / d_num_samples;
+    }
+
+    // edited section: hardware counters, floating point operations of one op for GFLOP/s
+    void set_flops(double flops) { d_flops = flops; }
+
     size_t get_ns_per_op() {
         if (d_num_iterations <= 0) {
             return 0;
@@ -351,6 +1810,7 @@ public:
 
     void run_n(size_t n) {
         d_num_iterations = n;
+        if (d_counters) d_counters->attach();
         reset_timer();
         start_timer();
         d_benchmark.get_func()(this);
@@ -370,24 +1830,119 @@ public:
         }
     }
 
+    /*
+     * edited section: adaptive sampling
+     * Finds the number of iterations n filling budget / samples, keeps running n until the warmup time has passed and
+     * then times samples of n iterations. Sampling stops at the most samples, or once there are enough of them and
+     * either the confidence interval of the mean is narrow enough or the budget is spent. A benchmark can change its
+     * budget with set_budget() while it is calibrated. Slow samples at the start, while the clock is still ramping up,
+     * are left out.
+     */
     result run() {
+        double rss = 0;
+        if (d_track_allocations) {   // edited section: allocation tracking
+            reset_peak_rss();
+            rss = resident_kb("VmRSS");
+        }
+
+        auto started = std::chrono::high_resolution_clock::now();
+        auto elapsed = [&]() { return std::chrono::high_resolution_clock::now() - started; };
+
+        // stays under the target, a single iteration longer than the budget still makes a sample
         size_t n = 1;
         run_n(n);
-        while (d_duration < d_benchtime && n < 1e9) {
+        while (d_duration < d_benchtime / 2 && n < 1e9 && elapsed() < d_budget) {
             size_t last = n;
             if (get_ns_per_op() == 0) {
                 n = static_cast<size_t>(1e9);
             } else {
-                n = d_duration.count() / get_ns_per_op();
+                n = d_benchtime.count() / get_ns_per_op();
+            }
+            n = std::max(round_down(std::min(n, 100*last)), last+1);
+            run_n(n);
+        }
+
+        struct sample {
+            std::chrono::nanoseconds duration;
+            counter_values           counters;
+            size_t                   allocations;
+            size_t                   bytes;
+        };
+        std::vector<sample> taken;
+        auto record = [&]() {
+            taken.push_back({d_duration, read_counters(), allocations.allocations.load(), allocations.bytes.load()});
+        };
+
+        // the last calibration run is the first sample when it already was long enough to warm up
+        if (elapsed() < d_warmup) {
+            while (elapsed() < d_warmup) run_n(n);
+        } else {
+            record();
+        }
+
+        std::vector<double> samples;
+        size_t ramp = 0;
+        while (true) {
+            if (taken.size() >= d_num_samples) break;
+            if (taken.size() >= d_min_samples + ramp) {
+                if (elapsed() >= d_budget || relative_interval(samples) <= d_confidence) break;
             }
-            n = std::max(std::min(n+n/2, 100*last), last+1);
-            n = round_up(n);
             run_n(n);
+            record();
+
+            samples.clear();
+            for (auto& t : taken) samples.push_back(double(t.duration.count()) / n);
+            ramp = ramp_length(samples);
+            samples.erase(samples.begin(), samples.begin() + ramp);
+        }
+        if (samples.empty()) {
+            for (auto& t : taken) samples.push_back(double(t.duration.count()) / n);
+            ramp = ramp_length(samples);
+            samples.erase(samples.begin(), samples.begin() + ramp);
+        }
+
+        std::chrono::nanoseconds total = std::chrono::nanoseconds::zero();
+        counter_values counters = taken[ramp].counters;
+        size_t allocs = 0, bytes = 0;
+        for (size_t i = ramp; i < taken.size(); ++i) {
+            total += taken[i].duration;
+            for (size_t c = 0; i > ramp && c < counters.size(); ++c) {
+                auto more = taken[i].counters[c];
+                counters[c] = counters[c] < 0 || more < 0 ? -1 : counters[c] + more;
+            }
+            allocs += taken[i].allocations;
+            bytes += taken[i].bytes;
+        }
+
+        // edited section: fixtures
+        for (auto& teardown : d_teardowns) {
+            teardown();
         }
-        return result(n, d_duration, d_num_bytes);
+        d_teardowns.clear();
+        d_fixtures.clear();
+        result r(d_benchmark, d_num_threads, d_size, n * samples.size(), total, d_num_bytes, samples);
+        r.set_discarded(ramp);
+        r.set_counters(counters);
+        r.set_flops(d_flops);
+        if (d_profiler) {
+            r.set_profile(d_profiler->collect(d_benchmark.get_full_name()));
+        }
+        if (d_track_allocations) {
+            allocation_counts counts;
+            counts.allocations = double(allocs);
+            counts.bytes = double(bytes);
+            counts.peak_rss_kb = std::max(resident_kb("VmHWM") - rss, 0.0);
+            r.set_allocations(counts);
+        }
+        return r;
     }
 
 private:
+    // edited section: hardware counters
+    counter_values read_counters() const {
+        return d_counters ? d_counters->read() : no_counters();
+    }
+
     template<typename T>
     T round_down_10(T n) {
         int tens = 0;
@@ -402,36 +1957,147 @@ private:
         return result;
     }
 
+    // edited section: adaptive sampling, 1/2/5 decades rounded down so calibration doesn't overshoot
     template<typename T>
-    T round_up(T n) {
+    T round_down(T n) {
         T base = round_down_10(n);
-        if (n < (2 * base)) {
-            return 2 * base;
+        if (n >= (10 * base)) {
+            return 10 * base;
         }
-        if (n < (5 * base)) {
+        if (n >= (5 * base)) {
             return 5 * base;
         }
-        return 10 * base;
+        if (n >= (2 * base)) {
+            return 2 * base;
+        }
+        return base;
+    }
+
+    // half width of the 95% confidence interval of the mean, relative to the mean
+    static double relative_interval(const std::vector<double>& samples) {
+        static const double t95[] = { 12.71, 4.30, 3.18, 2.78, 2.57, 2.45, 2.36, 2.31, 2.26, 2.23, 2.20, 2.18, 2.16,
+                                      2.14, 2.13, 2.12, 2.11, 2.10, 2.09, 2.09, 2.08, 2.07, 2.07, 2.06, 2.06, 2.06,
+                                      2.05, 2.05, 2.05, 2.04 };
+        size_t k = samples.size();
+        if (k < 2) {
+            return 1e300;
+        }
+        double mean = 0, sum = 0;
+        for (auto x : samples) mean += x;
+        mean /= k;
+        for (auto x : samples) sum += (x - mean) * (x - mean);
+        double t = k - 1 <= 30 ? t95[k - 2] : 1.96;
+        return mean > 0 ? t * std::sqrt(sum / (k - 1) / k) / mean : 0;
+    }
+
+    // leading samples well above the later ones, from turbo or frequency scaling settling, at most a third of them
+    static size_t ramp_length(const std::vector<double>& samples) {
+        if (samples.size() < 4) {
+            return 0;
+        }
+        std::vector<double> rest(samples.begin() + samples.size() / 2, samples.end());
+        std::sort(rest.begin(), rest.end());
+        double median = rest[rest.size() / 2];
+        std::vector<double> deviations;
+        for (auto x : rest) deviations.push_back(std::fabs(x - median));
+        std::sort(deviations.begin(), deviations.end());
+        double limit = median + std::max(3 * 1.4826 * deviations[deviations.size() / 2], 0.02 * median);
+
+        size_t ramp = 0;
+        while (ramp < samples.size() / 3 && samples[ramp] > limit) ++ramp;
+        return ramp;
     }
 };
 
 /*
  * The run_benchmarks function will run the registered benchmarks.
  */
-void run_benchmarks(const options& opts) {
+std::vector<result> run_benchmarks(const options& opts) {
+    std::vector<result> results;   // edited section: kept for json / csv
     std::regex match_r(opts.get_bench());
+    std::unique_ptr<profiler> sampler;   // edited section: sampling profiler
+    if (opts.get_profile_rate() > 0) {
+        sampler.reset(new profiler(opts.get_profile_rate()));
+    }
     auto benchmarks = registration::get_ptr()->get_benchmarks();
-    for (auto& info : benchmarks) {
-        if (std::regex_match(info.get_name(), match_r)) {
-            context c(info, opts);
-            auto r = c.run();
-            benchpress::out_stream << std::setw(35) << std::left << info.get_name() << r.to_string() << std::endl;
+    for (auto& registered : benchmarks) {
+        for (auto& info : registered.expand(opts.get_cpu())) {   // edited section: parameterized benchmarks
+            if (std::regex_match(info.get_full_name(), match_r)) {
+                context c(info, opts);
+                c.set_profiler(sampler.get());
+                auto r = c.run();
+                benchpress::out_stream << std::setw(35) << std::left << info.get_full_name() << r.to_string() << std::endl;
+                results.push_back(r);
+            }
         }
     }
+    return results;
 }
 
 } // namespace benchpress
 
+/*
+ * edited section: allocation tracking
+ * The counting operator new and delete, every other form of them ends up in these.
+ */
+#ifdef BENCHPRESS_TRACK_ALLOCATIONS
+namespace benchpress {
+// out of line, so the compiler doesn't pair the inlined new with std::free (-Wmismatched-new-delete)
+__attribute__((noinline)) void release(void* p) noexcept { std::free(p); }
+} // namespace benchpress
+
+void* operator new(std::size_t size) {
+    benchpress::allocations.record(size);
+    if (size == 0) size = 1;
+    while (true) {
+        if (void* p = std::malloc(size)) return p;
+        auto handler = std::get_new_handler();
+        if (handler == nullptr) throw std::bad_alloc();
+        handler();
+    }
+}
+void* operator new[](std::size_t size) { return operator new(size); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    try { return operator new(size); } catch (...) { return nullptr; }
+}
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    try { return operator new(size); } catch (...) { return nullptr; }
+}
+void operator delete(void* p) noexcept { benchpress::release(p); }
+void operator delete[](void* p) noexcept { benchpress::release(p); }
+void operator delete(void* p, std::size_t) noexcept { benchpress::release(p); }
+void operator delete[](void* p, std::size_t) noexcept { benchpress::release(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { benchpress::release(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { benchpress::release(p); }
+
+#ifdef __cpp_aligned_new
+void* operator new(std::size_t size, std::align_val_t align) {
+    benchpress::allocations.record(size);
+    auto alignment = std::max(static_cast<std::size_t>(align), sizeof(void*));
+    size = (std::max(size, std::size_t(1)) + alignment - 1) / alignment * alignment;
+    while (true) {
+        if (void* p = std::aligned_alloc(alignment, size)) return p;
+        auto handler = std::get_new_handler();
+        if (handler == nullptr) throw std::bad_alloc();
+        handler();
+    }
+}
+void* operator new[](std::size_t size, std::align_val_t align) { return operator new(size, align); }
+void* operator new(std::size_t size, std::align_val_t align, const std::nothrow_t&) noexcept {
+    try { return operator new(size, align); } catch (...) { return nullptr; }
+}
+void* operator new[](std::size_t size, std::align_val_t align, const std::nothrow_t&) noexcept {
+    try { return operator new(size, align); } catch (...) { return nullptr; }
+}
+void operator delete(void* p, std::align_val_t) noexcept { benchpress::release(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { benchpress::release(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { benchpress::release(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { benchpress::release(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { benchpress::release(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { benchpress::release(p); }
+#endif
+#endif
+
 /*
  * If BENCHPRESS_CONFIG_MAIN is defined when the file is included then a main function will be emitted which provides a
  * command-line parser and then executes run_benchmarks.
@@ -4,219 +4,1775 @@
 // #include <stdio.h>
 
 #include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
 #include <functional>
+#include <string>
 #include <initializer_list>
 #include <vector>
 #include <thread>
 #include <future>
 #include <mutex>
 #include <cmath>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
 #include <condition_variable>
 
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "pool.hpp"
+#include "gemm.hpp"
+#include "distributed.hpp"
+#include "expression.hpp"
+#include "view.hpp"
+
+
+// build with -DTHRD_STATS to fill DetStats, otherwise probes compile to nothing
+#ifdef THRD_STATS
+  #define THRD_PROBE(...) __VA_ARGS__
+#else
+  #define THRD_PROBE(...)
+#endif
+
 
 namespace thrd {
 
-typedef long double ld_t;
-const ld_t EPS = 1e-8;
+typedef long double ld_t;
+const ld_t EPS = 1e-8;
+
+
+/*
+  Where a determinant call spent its time, seconds per thread and phase. Only
+  DetLU has phases, other methods report the totals. valid is left false by
+  builds without -DTHRD_STATS, where nothing is measured.
+*/
+struct DetStats
+{
+  struct Thread
+  {
+    double pivot = 0;
+    double update = 0;
+    double barrier = 0;
+    size_t rows = 0;
+    size_t flops = 0;
+    size_t bytes = 0;
+  };
+
+  std::vector<Thread> threads;
+  double total = 0;
+  size_t flops = 0;
+  size_t bytes = 0;
+  size_t allocations = 0;
+  bool valid = false;
+};
+
+
+/*
+  Determinant with a bound on its relative error. escalated is set when the
+  double precision result wasn't good enough and it was computed again.
+  singular is set when the last precision tried met a zero pivot: det is 0
+  and there is no relative bound, the matrix is singular or within rounding
+  of it. Exact integer results are singular with relativeError 0.
+*/
+struct Certified
+{
+  ld_t det = 0;
+  ld_t relativeError = std::numeric_limits<ld_t>::infinity();
+  bool escalated = false;
+  bool singular = false;
+};
+
+
+/*
+  Cooperative cancellation of a determinant call: an explicit Cancel() or a
+  deadline. Engines poll it between LU columns and in the Laplace recursion.
+*/
+class CancelToken
+{
+public:
+  using clock = std::chrono::steady_clock;
+
+  CancelToken() : _cancelled(false), _deadline(clock::time_point::max().time_since_epoch().count()) {};
+  virtual ~CancelToken() = default;
+
+  void Cancel() { _cancelled = true; };
+  void SetDeadline(const clock::time_point);
+  bool Cancelled() const;
+
+private:
+  std::atomic<bool> _cancelled;
+  std::atomic<clock::rep> _deadline;
+};
+
+
+class CancelledError : public std::exception
+{
+public:
+  const char* what() const noexcept override { return "determinant cancelled"; };
+};
+
+
+/*
+  Result of DeterminantAsync(). get() throws CancelledError if the call was
+  cancelled or ran past its deadline, dropping the handle cancels the call.
+*/
+class DetFuture
+{
+public:
+  DetFuture(std::future<ld_t>&&, std::shared_ptr<CancelToken>);
+  DetFuture(DetFuture&&) = default;
+  virtual ~DetFuture();
+
+  ld_t get() { return _future.get(); };
+  bool ready() const;
+  template<typename R, typename P>
+  std::future_status wait_for(const std::chrono::duration<R, P>& timeout) const { return _future.wait_for(timeout); };
+
+  void Cancel() { _token->Cancel(); };
+  void SetDeadline(const CancelToken::clock::time_point deadline) { _token->SetDeadline(deadline); };
+
+private:
+  std::future<ld_t> _future;
+  std::shared_ptr<CancelToken> _token;
+};
+
+
+class Probe
+{
+public:
+  using clock = std::chrono::steady_clock;
+
+  Probe(DetStats::Thread* thread) : _thread(thread), _last(thread ? clock::now() : clock::time_point()) {};
+  virtual ~Probe() = default;
+
+  void Lap(double DetStats::Thread::*);
+  void Rows(const size_t, const size_t);
+
+private:
+  DetStats::Thread* _thread;
+  clock::time_point _last;
+};
+
+
+class Barrier
+{
+public:
+  Barrier(const size_t count);
+  virtual ~Barrier() = default;
+
+  void Wait();
+  // void Break();
+
+private:
+  std::condition_variable _cv;
+  std::mutex _mtx;
+  size_t _counter;
+  size_t _waiting;
+  const size_t _threadCount;
+};
+
+
+/*
+  Pivot search as a tournament. Every thread offers the best row of its own
+  block, the second thread to reach a tree node merges the sibling subtree and
+  climbs on, the first one leaves. No thread waits for another and the result
+  doesn't depend on the number of threads.
+*/
+class Tournament
+{
+public:
+  Tournament() = default;
+  virtual ~Tournament() = default;
+
+  void Reset(const size_t);
+  void Offer(const size_t, const ld_t, const size_t);
+  const size_t Winner() const { return _slots[0].row; };
+
+private:
+  struct Candidate
+  {
+    ld_t value;
+    size_t row;
+  };
+
+  std::vector<Candidate> _slots;
+  std::unique_ptr< std::atomic<size_t>[] > _arrivals;
+  size_t _capacity = 0;
+  size_t _count = 0;
+  size_t _levels = 0;
+
+  friend class Arena;
+};
+
+
+/*
+  Scratch buffers for determinant calls. Every thread owns one arena, buffers
+  survive between calls and grow geometrically, so a steady stream of
+  same-sized (or smaller) matrices doesn't touch the heap. The threads LU and
+  Laplace run on are kept in the arena's crew for the same reason.
+*/
+class Arena
+{
+public:
+  using vector_s_t = typename std::vector<size_t>;
+  using vector_ld_t = typename std::vector<ld_t>;
+  using table_ld_t = typename std::vector<vector_ld_t>;
+
+  // a subtree of the Laplace expansion: columns [start, start + count) of the first row
+  struct Branch
+  {
+    size_t start = 0;
+    size_t count = 0;
+    ld_t value = 0;
+  };
+
+  struct Stats
+  {
+    size_t requests = 0;
+    size_t allocations = 0;
+    size_t bytes = 0;
+  };
+
+  /*
+    Grants exclusive access to the thread's arena. If it is already taken
+    by an outer call on the same thread, a private one is used instead.
+    The allocations made through the lease are added to the given stats.
+  */
+  class Lease
+  {
+  public:
+    Lease(DetStats* = nullptr);
+    virtual ~Lease();
+
+    Arena* operator->() { return _arena; };
+    Arena& operator*() { return *_arena; };
+
+  private:
+    std::unique_ptr<Arena> _spare;
+    Arena* _arena;
+    DetStats* _stats;
+    size_t _allocations;
+  };
+
+  virtual ~Arena() = default;
+
+  static Arena& Local();
+
+  vector_s_t& Swap(const size_t);
+  table_ld_t& Table(const size_t);
+  vector_ld_t& Buffer(const size_t);
+  std::vector<double>& Doubles(const size_t);
+  std::vector<__int128>& Integers(const size_t);
+  std::vector< vector_s_t >& Used(const size_t, const size_t);
+  table_ld_t& Columns(const size_t, const size_t);
+  std::vector<Branch>& Branches(const size_t);
+  Crew& Workers(const size_t);
+  Tournament& Pivots(const size_t);
+
+  const Stats& GetStats() const { return _stats; };
+  void Release();
+
+private:
+  template<typename V>
+  void Reserve(V&, const size_t);
+  template<typename V>
+  void Resize(std::vector<V>&, std::vector<V>&, const size_t, const size_t);
+
+  vector_s_t _swap;
+  table_ld_t _table, _tableSpare;
+  table_ld_t _columns, _columnsSpare;
+  vector_ld_t _buffer;
+  std::vector<double> _doubles;
+  std::vector<__int128> _integers;
+  std::vector< vector_s_t > _used, _usedSpare;
+  std::vector<Branch> _branches;
+  std::unique_ptr<Crew> _crew;
+  Tournament _pivots;
+  Stats _stats;
+  bool _leased = false;
+};
+
+
+/*
+  Crossovers used by the AUTO method. Defaults are taken from the benchmarks,
+  Calibrate() measures them on this machine and Save() keeps them for the next
+  start, Get() loads them once from $THRD_TUNING or "tuning.txt". tolerance
+  is the relative error AUTO may trade for double precision, 0 turns it off.
+*/
+struct Tuning
+{
+  size_t laplaceMax = 4;
+  size_t serialMax = 150;
+  size_t rowsPerThread = 75;
+  size_t tiledMin = 600;
+  size_t mixedMin = 256;
+  double tolerance = 0;
+
+  static Tuning& Get();
+  static Tuning Calibrate(size_t = 0);
+  static std::string Path();
+
+  bool Load(const std::string&);
+  bool Save(const std::string&) const;
+};
+
+
+// shared by every Matrix type, so the methods are the same for any T and layout
+struct DeterminantMethods
+{
+  enum Methods { LAPLACE, LU, RLU, TILED, DISTRIBUTED, AUTO };
+};
+
+
+/*
+  Square matrix of T stored in the order given by Layout (layout.hpp). The
+  determinant methods read the elements through the layout once, into their
+  own working buffers, so any layout works with every method.
+*/
+template<typename T, typename Layout>
+class Matrix : public Expression< Matrix<T, Layout> >, public DeterminantMethods
+{
+public:
+  using value_type = T;
+  using deleter_t = typename std::function<void(T*)>;
+  using storage_t = typename std::unique_ptr<T[], deleter_t>;
+  using vector_s_t = typename std::vector<size_t>;
+  using vector_ld_t = typename std::vector<ld_t>;
+  using table_ld_t = typename std::vector<vector_ld_t>;
+
+  virtual ~Matrix() = default;
+
+  Matrix();
+  Matrix(const size_t n);
+  Matrix(const size_t n, const T val);
+  Matrix(const std::initializer_list< std::initializer_list<T> >);
+  template<typename E>
+  Matrix(const Expression<E>&);
+  // adopt Layout::Capacity(n) elements, released with delete[] or the deleter, an empty one leaves them to the caller
+  Matrix(std::unique_ptr<T[]>, const size_t n);
+  Matrix(T*, const size_t n, deleter_t);
+
+  Matrix(const Matrix&);
+  Matrix(Matrix&&) noexcept;
+  Matrix& operator=(const Matrix&);
+  Matrix& operator=(Matrix&&) noexcept;
+
+  // a plain pointer for row-major storage, a proxy row otherwise
+  typename Layout::template row_t<T> operator[](size_t i) { return Layout::Row(data.get(), i, _size); };
+  typename Layout::template row_t<const T> operator[](size_t i) const { return Layout::Row(static_cast<const T*>(data.get()), i, _size); };
+  T operator()(const size_t i, const size_t j) const { return Element(i, j); };
+  // bool operator==(const Matrix&);
+
+  const size_t size() const { return _size; };
+
+  // strided layouts only
+  MatrixView<T> View();
+  MatrixView<const T> View() const;
+  // determinant methods of the result read the view in place, it must outlive the matrix, copies don't
+  static Matrix Borrow(const MatrixView<const T>&);
+
+  Matrix Multiply(const Matrix&, size_t = 1) const;
+
+  /*
+    NOT CONST CAUSE OF SHARED PRIVATE VARIABLES
+  */
+  ld_t Determinant(size_t = 1, const Methods = LU);
+  ld_t Determinant(size_t, const Methods, DetStats&);
+  DetFuture DeterminantAsync(size_t = 1, const Methods = LU,
+                             const CancelToken::clock::time_point = CancelToken::clock::time_point::max());
+  ld_t DeterminantLU(size_t = 1);
+  ld_t DeterminantLaplace(size_t = 1);
+  ld_t DeterminantRLU(size_t = 1);
+  ld_t DeterminantTiled(size_t = 1, size_t = 64);
+  ld_t DeterminantDistributed(size_t = 1, size_t = 32);
+  ld_t DeterminantAuto(size_t = 0);
+  Certified DeterminantCertified(size_t = 1, const ld_t = 1e-10);
+
+  bool IsTriangular() const;
+
+private:
+  struct borrow_t {};
+  Matrix(borrow_t, const MatrixView<const T>&);
+
+  storage_t data;
+  size_t _size;
+  MatrixView<const T> _borrowed;
+
+  static storage_t Allocate(const size_t);
+
+  T& At(const size_t i, const size_t j) { return data[Layout::Index(i, j, _size)]; };
+  const T& At(const size_t i, const size_t j) const { return data[Layout::Index(i, j, _size)]; };
+  // what the determinant methods read
+  T Element(const size_t i, const size_t j) const { return _borrowed ? _borrowed(i, j) : At(i, j); };
+  template<typename F>
+  void ForEach(F) const;
+
+  size_t _perThread = 1;
+  size_t _modThread = 0;
+  size_t _threadsCount = 5;
+  DetStats* _stats = nullptr;
+  const CancelToken* _token = nullptr;
+  bool _aborted = false;
+
+  ld_t DetRecursive(size_t, size_t, size_t, vector_s_t&);
+  void DetLU(table_ld_t&, vector_s_t&, ld_t&, Tournament&, Barrier&, Barrier&, const size_t = 0);
+  void DetRLU(ld_t*, vector_s_t&, const size_t, const size_t);
+  void UpdateRLU(const ld_t*, const ld_t*, ld_t*, const size_t, const size_t, const size_t);
+  void UpdateKernel(const ld_t*, const ld_t*, ld_t*, const size_t, const size_t, const size_t);
+  void TilePanel(ld_t*, vector_s_t&, const size_t, const size_t);
+  void TileSolve(ld_t*, const vector_s_t&, const size_t, const size_t, const size_t, const size_t);
+  template<typename W>
+  ld_t DetMixed(std::vector<W>&, vector_s_t&, table_ld_t&, ld_t&, bool&);
+  template<typename W>
+  ld_t InverseNorm(const std::vector<W>&, const vector_s_t&, table_ld_t&);
+  bool DetBareiss(std::vector<__int128>&, ld_t&);
+};
+
+
+/*
+  Entry points for expressions like Determinant(A * B + C): the expression is
+  evaluated into one matrix, products reuse the matrix they already hold.
+*/
+template<typename E>
+ld_t Determinant(const Expression<E>& e, size_t threadsCount = 1, const DeterminantMethods::Methods method = DeterminantMethods::LU)
+{
+  return Evaluate(e.self())->Determinant(threadsCount, method);
+}
+
+template<typename T, typename L>
+ld_t Determinant(Matrix<T, L>& M, size_t threadsCount = 1, const DeterminantMethods::Methods method = DeterminantMethods::LU)
+{
+  return M.Determinant(threadsCount, method);
+}
+
+template<typename E>
+ld_t DeterminantLU(const Expression<E>& e, size_t threadsCount = 1)
+{
+  return Evaluate(e.self())->DeterminantLU(threadsCount);
+}
+
+template<typename T, typename L>
+ld_t DeterminantLU(Matrix<T, L>& M, size_t threadsCount = 1)
+{
+  return M.DeterminantLU(threadsCount);
+}
+
+// square views, read in place without copying into a Matrix first
+template<typename T>
+ld_t Determinant(const MatrixView<T>& view, size_t threadsCount = 1, const DeterminantMethods::Methods method = DeterminantMethods::LU)
+{
+  if (view.Rows() != view.Cols()) {
+    throw std::invalid_argument("matrix isn't square");
+  }
+  return Matrix<typename MatrixView<T>::value_type>::Borrow(view).Determinant(threadsCount, method);
+}
+
+template<typename T>
+ld_t DeterminantLU(const MatrixView<T>& view, size_t threadsCount = 1)
+{
+  if (view.Rows() != view.Cols()) {
+    throw std::invalid_argument("matrix isn't square");
+  }
+  return Matrix<typename MatrixView<T>::value_type>::Borrow(view).DeterminantLU(threadsCount);
+}
+
+
+Barrier::Barrier(const size_t count) : _counter(0), _waiting(0), _threadCount(count) {};
+
+void Barrier::Wait()
+{
+  std::unique_lock<std::mutex> lock(_mtx);
+  ++_counter;
+  ++_waiting;
+  _cv.wait(lock, [&]() { return _counter >= _threadCount; });
+  --_waiting;
+  _cv.notify_one();
+  if (_waiting == 0) _counter = 0;
+  lock.unlock();
+}
+
+void Tournament::Reset(const size_t count)
+{
+  _count = count;
+  _levels = 0;
+  while ((static_cast<size_t>(1) << _levels) < count) ++_levels;
+  _slots.resize(count);
+  for (size_t i = 0; i < count * _levels; ++i) {
+    _arrivals[i] = 0;
+  }
+}
+
+void Tournament::Offer(const size_t thread, const ld_t value, const size_t row)
+{
+  _slots[thread] = { value, row };
+
+  // subtree results are kept in the slot of their leftmost thread
+  for (size_t level = 0; level < _levels; ++level) {
+    auto node = thread >> (level + 1);
+    auto left = node << (level + 1);
+    auto right = left + (static_cast<size_t>(1) << level);
+    if (right >= _count) continue;
+
+    if (_arrivals[level * _count + node].fetch_add(1, std::memory_order_acq_rel) % 2 == 0) return;
+
+    auto& a = _slots[left];
+    const auto& b = _slots[right];
+    if (b.value > a.value || (b.value == a.value && b.row < a.row)) {
+      a = b;
+    }
+  }
+}
+
+Arena& Arena::Local()
+{
+  thread_local Arena arena;
+  return arena;
+}
+
+Arena::Lease::Lease(DetStats* stats) : _arena(&Arena::Local()), _stats(stats)
+{
+  if (_arena->_leased) {
+    _spare.reset(new Arena());
+    _arena = _spare.get();
+  }
+  _arena->_leased = true;
+  _allocations = _arena->_stats.allocations;
+}
+
+Arena::Lease::~Lease()
+{
+  if (_stats) _stats->allocations += _arena->_stats.allocations - _allocations;
+  _arena->_leased = false;
+}
+
+template<typename V>
+void Arena::Reserve(V& buffer, const size_t n)
+{
+  auto capacity = buffer.capacity();
+  if (capacity >= n) return;
+
+  buffer.reserve(std::max(n, capacity << 1));
+  ++_stats.allocations;
+  _stats.bytes += (buffer.capacity() - capacity) * sizeof(typename V::value_type);
+}
+
+// shrinking keeps the dropped rows aside, so they are not freed and reallocated
+template<typename V>
+void Arena::Resize(std::vector<V>& table, std::vector<V>& spare, const size_t count, const size_t n)
+{
+  Reserve(table, count);
+  Reserve(spare, table.capacity());
+  while (table.size() > count) {
+    spare.push_back(std::move(table.back()));
+    table.pop_back();
+  }
+  while (table.size() < count) {
+    if (spare.empty()) {
+      table.emplace_back();
+    } else {
+      table.push_back(std::move(spare.back()));
+      spare.pop_back();
+    }
+  }
+  for (auto& row : table) {
+    Reserve(row, n);
+    row.resize(n);
+  }
+}
+
+Arena::vector_s_t& Arena::Swap(const size_t n)
+{
+  ++_stats.requests;
+  Reserve(_swap, n);
+  _swap.resize(n);
+  for (size_t i = 0; i < n; ++i) {
+    _swap[i] = i;
+  }
+  return _swap;
+}
+
+Arena::table_ld_t& Arena::Table(const size_t n)
+{
+  ++_stats.requests;
+  Resize(_table, _tableSpare, n, n);
+  return _table;
+}
+
+Arena::vector_ld_t& Arena::Buffer(const size_t n)
+{
+  ++_stats.requests;
+  Reserve(_buffer, n);
+  _buffer.resize(n);
+  return _buffer;
+}
+
+std::vector<double>& Arena::Doubles(const size_t n)
+{
+  ++_stats.requests;
+  Reserve(_doubles, n);
+  _doubles.resize(n);
+  return _doubles;
+}
+
+std::vector<__int128>& Arena::Integers(const size_t n)
+{
+  ++_stats.requests;
+  Reserve(_integers, n);
+  _integers.resize(n);
+  return _integers;
+}
+
+std::vector< Arena::vector_s_t >& Arena::Used(const size_t count, const size_t n)
+{
+  ++_stats.requests;
+  Resize(_used, _usedSpare, count, n);
+  for (auto& used : _used) {
+    std::fill(used.begin(), used.end(), 0);
+  }
+  return _used;
+}
+
+Arena::table_ld_t& Arena::Columns(const size_t count, const size_t n)
+{
+  ++_stats.requests;
+  Resize(_columns, _columnsSpare, count, n);
+  return _columns;
+}
+
+std::vector<Arena::Branch>& Arena::Branches(const size_t count)
+{
+  ++_stats.requests;
+  Reserve(_branches, count);
+  _branches.clear();
+  return _branches;
+}
+
+// threads are counted as allocations, they are only started when the crew grows
+Crew& Arena::Workers(const size_t count)
+{
+  ++_stats.requests;
+  if (!_crew) {
+    _crew.reset(new Crew());
+    ++_stats.allocations;
+  }
+  if (_crew->size() < count) {
+    _stats.allocations += count - _crew->size();
+  }
+  return *_crew;
+}
+
+Tournament& Arena::Pivots(const size_t count)
+{
+  ++_stats.requests;
+  Reserve(_pivots._slots, count);
+  size_t counters = 0;
+  while ((static_cast<size_t>(1) << (counters / count)) < count) counters += count;
+  if (_pivots._capacity < counters) {
+    auto capacity = std::max(counters, _pivots._capacity << 1);
+    _pivots._arrivals.reset(new std::atomic<size_t>[capacity]);
+    ++_stats.allocations;
+    _stats.bytes += (capacity - _pivots._capacity) * sizeof(std::atomic<size_t>);
+    _pivots._capacity = capacity;
+  }
+  _pivots.Reset(count);
+  return _pivots;
+}
+
+void Arena::Release()
+{
+  vector_s_t().swap(_swap);
+  table_ld_t().swap(_table);
+  table_ld_t().swap(_tableSpare);
+  table_ld_t().swap(_columns);
+  table_ld_t().swap(_columnsSpare);
+  vector_ld_t().swap(_buffer);
+  std::vector<double>().swap(_doubles);
+  std::vector<__int128>().swap(_integers);
+  std::vector< vector_s_t >().swap(_used);
+  std::vector< vector_s_t >().swap(_usedSpare);
+  std::vector<Branch>().swap(_branches);
+  _crew.reset();
+  std::vector<Tournament::Candidate>().swap(_pivots._slots);
+  _pivots._arrivals.reset();
+  _pivots._capacity = 0;
+  _stats.bytes = 0;
+}
+
+void CancelToken::SetDeadline(const clock::time_point deadline)
+{
+  _deadline = deadline.time_since_epoch().count();
+}
+
+bool CancelToken::Cancelled() const
+{
+  if (_cancelled) return true;
+  auto deadline = _deadline.load();
+  return deadline != clock::time_point::max().time_since_epoch().count()
+      && clock::now().time_since_epoch().count() >= deadline;
+}
+
+DetFuture::DetFuture(std::future<ld_t>&& future, std::shared_ptr<CancelToken> token)
+  : _future(std::move(future)), _token(token) {};
+
+DetFuture::~DetFuture()
+{
+  if (_token) _token->Cancel();
+}
+
+bool DetFuture::ready() const
+{
+  return _future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+void Probe::Lap(double DetStats::Thread::* phase)
+{
+  if (_thread == nullptr) return;
+  auto now = clock::now();
+  _thread->*phase += std::chrono::duration<double>(now - _last).count();
+  _last = now;
+}
+
+// rows updated with rank-1 changes of the given length
+void Probe::Rows(const size_t count, const size_t length)
+{
+  if (_thread == nullptr) return;
+  _thread->rows += count;
+  _thread->flops += 2 * count * length;
+  _thread->bytes += 3 * count * length * sizeof(ld_t);
+}
+
+// left uninitialized, every caller writes all the elements
+template<typename T, typename Layout>
+typename Matrix<T, Layout>::storage_t Matrix<T, Layout>::Allocate(const size_t count)
+{
+  return storage_t(new T[count], [](T* p) { delete[] p; });
+}
+
+template<typename T, typename Layout>
+Matrix<T, Layout>::Matrix() : Matrix(0) {};
+
+template<typename T, typename Layout>
+Matrix<T, Layout>::Matrix(const size_t n) : Matrix(n, T()) {};
+
+template<typename T, typename Layout>
+Matrix<T, Layout>::Matrix(const size_t n, const T val) : data(Allocate(Layout::Capacity(n))), _size(n)
+{
+  std::fill(data.get(), data.get() + Layout::Capacity(n), val);
+};
+
+template<typename T, typename Layout>
+Matrix<T, Layout>::Matrix(std::unique_ptr<T[]> elements, const size_t n)
+  : data(elements.release(), [](T* p) { delete[] p; }), _size(n) {};
+
+template<typename T, typename Layout>
+Matrix<T, Layout>::Matrix(T* elements, const size_t n, deleter_t deleter)
+  : data(elements, deleter ? std::move(deleter) : [](T*) {}), _size(n) {};
+
+// a copy always owns its elements, borrowed ones are read through the view
+template<typename T, typename Layout>
+Matrix<T, Layout>::Matrix(const Matrix& other) : data(Allocate(Layout::Capacity(other._size))), _size(other._size)
+{
+  if (!other._borrowed) {
+    std::copy(other.data.get(), other.data.get() + Layout::Capacity(_size), data.get());
+    return;
+  }
+  if (Layout::Capacity(_size) != _size * _size) {
+    std::fill(data.get(), data.get() + Layout::Capacity(_size), T());
+  }
+  for (size_t i = 0; i < _size; ++i) {
+    for (size_t j = 0; j < _size; ++j) {
+      At(i, j) = other._borrowed(i, j);
+    }
+  }
+};
+
+// the scratch state is per call, only the elements move
+template<typename T, typename Layout>
+Matrix<T, Layout>::Matrix(Matrix&& other) noexcept
+  : data(std::move(other.data)), _size(other._size), _borrowed(std::move(other._borrowed))
+{
+  other._size = 0;
+};
+
+template<typename T, typename Layout>
+Matrix<T, Layout>& Matrix<T, Layout>::operator=(const Matrix& other)
+{
+  if (this != &other) *this = Matrix(other);
+  return *this;
+}
+
+template<typename T, typename Layout>
+Matrix<T, Layout>& Matrix<T, Layout>::operator=(Matrix&& other) noexcept
+{
+  data = std::move(other.data);
+  _size = other._size;
+  _borrowed = std::move(other._borrowed);
+  other._size = 0;
+  return *this;
+}
+
+template<typename T, typename Layout>
+Matrix<T, Layout>::Matrix(const std::initializer_list< std::initializer_list<T> > d) : Matrix(d.size())
+{
+  size_t i = 0, j = 0;
+  for (const auto& l : d) {
+    for (const auto& v : l) {
+      At(i, j) = v;
+      ++j;
+    }
+    j = 0;
+    ++i;
+  }
+};
+
+template<typename T, typename Layout>
+Matrix<T, Layout>::Matrix(borrow_t, const MatrixView<const T>& view) : Matrix(0)
+{
+  _size = view.size();
+  _borrowed = view;
+};
+
+template<typename T, typename Layout>
+Matrix<T, Layout> Matrix<T, Layout>::Borrow(const MatrixView<const T>& view)
+{
+  return Matrix<T, Layout>(borrow_t(), view);
+}
+
+// evaluates the whole expression in one pass, rows are split over the shared pool
+template<typename T, typename Layout>
+template<typename E>
+Matrix<T, Layout>::Matrix(const Expression<E>& e) : data(Allocate(Layout::Capacity(e.size()))), _size(e.size())
+{
+  if (Layout::Capacity(_size) != _size * _size) {
+    std::fill(data.get(), data.get() + Layout::Capacity(_size), T());
+  }
+
+  // square blocks, so reads and writes stay local whatever the two layouts are
+  const auto& expr = e.self();
+  auto rows = [this, &expr](size_t from, size_t to) {
+    const size_t block = 32;
+    for (size_t jb = 0; jb < _size; jb += block) {
+      for (size_t i = from; i < to; ++i) {
+        for (size_t j = jb; j < std::min(jb + block, _size); ++j) {
+          At(i, j) = static_cast<T>(expr(i, j));
+        }
+      }
+    }
+  };
+
+  const size_t minRows = 16;
+  auto chunks = std::min(ThreadPool::Shared().size(), _size * _size / (minRows * minRows));
+  if (chunks < 2) {
+    rows(0, _size);
+    return;
+  }
+
+  TaskGroup group;
+  for (size_t c = 1; c < chunks; ++c) {
+    group.Run([&rows, c, chunks, this]() { rows(c * _size / chunks, (c + 1) * _size / chunks); });
+  }
+  rows(0, _size / chunks);
+  group.Wait();
+};
+
+template<typename T, typename Layout>
+MatrixView<T> Matrix<T, Layout>::View()
+{
+  static_assert(Layout::strided, "the layout has no strides for a view");
+  return MatrixView<T>(data.get(), _size, _size, Layout::RowStride(_size), Layout::ColStride(_size));
+}
+
+template<typename T, typename Layout>
+MatrixView<const T> Matrix<T, Layout>::View() const
+{
+  static_assert(Layout::strided, "the layout has no strides for a view");
+  if (_borrowed) return _borrowed;
+  return MatrixView<const T>(data.get(), _size, _size, Layout::RowStride(_size), Layout::ColStride(_size));
+}
+
+// calls f(i, j, element) in the order the elements are stored
+template<typename T, typename Layout>
+template<typename F>
+void Matrix<T, Layout>::ForEach(F f) const
+{
+  if (_borrowed) {
+    RowMajor::Traverse(_size, [&](size_t i, size_t j, size_t) { f(i, j, _borrowed(i, j)); });
+    return;
+  }
+  const T* elements = data.get();
+  Layout::Traverse(_size, [&](size_t i, size_t j, size_t k) { f(i, j, elements[k]); });
+}
+
+template<typename T, typename Layout>
+Matrix<T, Layout> Matrix<T, Layout>::Multiply(const Matrix<T, Layout>& other, size_t threadsCount) const
+{
+  if (other.size() != _size) {
+    throw std::invalid_argument("matrix sizes don't match");
+  }
+  // borrowed elements may be scattered, Gemm wants them in rows
+  if (_borrowed) return Matrix<T, Layout>(_borrowed).Multiply(other, threadsCount);
+  if (other._borrowed) return Multiply(Matrix<T, Layout>(other._borrowed), threadsCount);
+  if (!Layout::strided) {
+    return Matrix<T, Layout>(Matrix<T>(*this).Multiply(Matrix<T>(other), threadsCount));
+  }
+
+  const auto rs = Layout::RowStride(_size);
+  const auto cs = Layout::ColStride(_size);
+  Matrix<T, Layout> result(_size);
+  Gemm<T>(
+    _size, _size, _size, T(1),
+    data.get(), rs, cs,
+    other.data.get(), rs, cs,
+    T(), result.data.get(), rs, cs,
+    threadsCount
+  );
+  return result;
+}
+
+template<typename T, typename Layout>
+ld_t Matrix<T, Layout>::Determinant(size_t threadsCount, const Methods method)
+{
+  if (size() == 0) return 0;
+  if (method == AUTO) return DeterminantAuto(threadsCount);
+  if (threadsCount < 1) threadsCount = 1;
+
+  switch (method) {
+    case LAPLACE:
+      return DeterminantLaplace(threadsCount);
+    case RLU:
+      return DeterminantRLU(threadsCount);
+    case TILED:
+      return DeterminantTiled(threadsCount);
+    case DISTRIBUTED:
+      return DeterminantDistributed(threadsCount);
+    default:
+      return DeterminantLU(threadsCount);
+  }
+}
+
+template<typename T, typename Layout>
+ld_t Matrix<T, Layout>::Determinant(size_t threadsCount, const Methods method, DetStats& stats)
+{
+  stats = DetStats();
+  THRD_PROBE(
+    auto start = Probe::clock::now();
+    stats.valid = true;
+    _stats = &stats;
+  )
+
+  auto det = Determinant(threadsCount, method);
+
+  THRD_PROBE(
+    _stats = nullptr;
+    stats.total = std::chrono::duration<double>(Probe::clock::now() - start).count();
+    for (const auto& thread : stats.threads) {
+      stats.flops += thread.flops;
+      stats.bytes += thread.bytes;
+    }
+    if (stats.threads.empty() && method != LAPLACE) {
+      stats.flops = 2 * _size * _size * _size / 3;
+      stats.bytes = _size * _size * sizeof(ld_t);
+    }
+  )
+  return det;
+}
+
+/*
+  Runs the call on the shared pool over a private copy of the matrix, so the
+  caller may change or destroy it in the meantime.
+*/
+template<typename T, typename Layout>
+DetFuture Matrix<T, Layout>::DeterminantAsync(size_t threadsCount, const Methods method, const CancelToken::clock::time_point deadline)
+{
+  auto token = std::make_shared<CancelToken>();
+  auto promise = std::make_shared< std::promise<ld_t> >();
+  auto matrix = std::make_shared< Matrix<T, Layout> >(*this);
+  token->SetDeadline(deadline);
+
+  DetFuture future(promise->get_future(), token);
+  ThreadPool::Shared().Submit([=]() {
+    try {
+      if (token->Cancelled()) throw CancelledError();
+      matrix->_token = token.get();
+      auto det = matrix->Determinant(threadsCount, method);
+      if (token->Cancelled()) throw CancelledError();
+      promise->set_value(det);
+    } catch (...) {
+      promise->set_exception(std::current_exception());
+    }
+  });
+  return future;
+}
+
+template<typename T, typename Layout>
+ld_t Matrix<T, Layout>::DeterminantLU(size_t threadsCount)
+{
+  if (size() == 0) return 0;
+  if (threadsCount < 1) threadsCount = 1;
+  _threadsCount = threadsCount;
+
+  Barrier s1(threadsCount), s2(threadsCount);
+  ld_t det = 1;
+  Arena::Lease arena(_stats);
+  auto& swap = arena->Swap(_size);
+  auto& matrix = arena->Table(_size);
+  auto& pivots = arena->Pivots(threadsCount);
+  ForEach([&](size_t i, size_t j, const T v) { matrix[i][j] = static_cast<ld_t>(v); });
+
+  THRD_PROBE( if (_stats) _stats->threads.resize(threadsCount); )
+
+  auto lu = [&](size_t i) { DetLU(matrix, swap, det, pivots, s1, s2, i); };
+  arena->Workers(threadsCount).Run(threadsCount, lu);
+
+  if (std::isnan(det)) {
+    det = .0;
+  }
+  return det;
+}
+
+template<typename T, typename Layout>
+ld_t Matrix<T, Layout>::DeterminantLaplace(size_t threadsCount)
+{
+  if (size() == 0) return 0;
+  if (threadsCount < 1) threadsCount = 1;
+  _threadsCount = threadsCount;
+
+  _perThread = std::max(static_cast<size_t>(1), size() / threadsCount);
+  _modThread = _size - std::min(_perThread * threadsCount, _size);
+  size_t asyncSize = 0;
 
+  Arena::Lease arena(_stats);
+  auto& used = arena->Used(threadsCount, _size);
 
-class Barrier
+  // branch 0 is the rest of the row, it stays on the calling thread
+  auto& branches = arena->Branches(threadsCount);
+  branches.emplace_back();
+  for (size_t i = 1; i < threadsCount && asyncSize < _size - 1; ++i) {
+    branches.emplace_back();
+    branches.back().start = asyncSize;
+    branches.back().count = _perThread + (_modThread > 0);
+    asyncSize += _perThread + (_modThread-- > 0);
+  }
+  branches[0].start = asyncSize;
+  branches[0].count = _size - asyncSize;
+
+  auto expand = [&](size_t i) {
+    branches[i].value = DetRecursive(branches[i].start, branches[i].count, 0, used[i]);
+  };
+  arena->Workers(branches.size()).Run(branches.size(), expand);
+
+  ld_t result = 0;
+  for (const auto& branch : branches) {
+    result += branch.value;
+  }
+  return result;
+}
+
+template<typename T, typename Layout>
+ld_t Matrix<T, Layout>::DeterminantRLU(size_t threadsCount)
 {
-public:
-  Barrier(const size_t count);
-  virtual ~Barrier() = default;
+  if (size() == 0) return 0;
+  if (threadsCount < 1) threadsCount = 1;
+  _threadsCount = threadsCount;
 
-  void Wait();
-  // void Break();
+  // column-major copy, so panels and update blocks are contiguous columns
+  Arena::Lease arena(_stats);
+  auto& swap = arena->Swap(_size);
+  auto& matrix = arena->Buffer(_size * _size);
+  ForEach([&](size_t i, size_t j, const T v) { matrix[i + j * _size] = static_cast<ld_t>(v); });
 
-private:
-  std::condition_variable _cv;
-  std::mutex _mtx;
-  size_t _counter;
-  size_t _waiting;
-  const size_t _threadCount;
-};
+  DetRLU(matrix.data(), swap, 0, _size);
 
+  ld_t det = 1;
+  for (size_t k = 0; k < _size; ++k) {
+    det *= matrix[k + k * _size] * (2 * (swap[k] == k) - 1);
+  }
+  return det;
+}
 
-template<typename T>
-class Matrix
+/*
+  Picks the method and the threads count (at most threadsCount, 0 means all
+  cores) from the matrix size and structure using the Tuning crossovers.
+  Matrices of mixedMin rows and more are factored in double only when
+  Tuning::tolerance is above 0, the default 0 keeps them in long double.
+*/
+template<typename T, typename Layout>
+ld_t Matrix<T, Layout>::DeterminantAuto(size_t threadsCount)
 {
-public:
-  using vector_t = typename std::vector<T>;
-  using vector_s_t = typename std::vector<size_t>;
-  using vector_ld_t = typename std::vector<ld_t>;
-  using table_t = typename std::vector<vector_t>;
-  using table_ld_t = typename std::vector<vector_ld_t>;
+  if (size() == 0) return 0;
+  if (threadsCount < 1) threadsCount = std::max(std::thread::hardware_concurrency(), 1u);
 
-  enum Methods { LAPLACE, LU };
+  if (IsTriangular()) {
+    ld_t det = 1;
+    for (size_t i = 0; i < _size; ++i) {
+      det *= static_cast<ld_t>(Element(i, i));
+    }
+    return det;
+  }
 
-  virtual ~Matrix() = default;
+  const auto& tuning = Tuning::Get();
+  if (_size <= tuning.laplaceMax) return DeterminantLaplace(1);
+  if (_size <= tuning.serialMax) return DeterminantLU(1);
 
-  Matrix();
-  Matrix(const size_t n);
-  Matrix(const size_t n, const T val);
-  Matrix(const std::initializer_list< std::initializer_list<T> >);
+  threadsCount = std::min(threadsCount, std::max(_size / std::max(tuning.rowsPerThread, static_cast<size_t>(1)), static_cast<size_t>(1)));
+  if (tuning.tolerance > 0 && _size >= tuning.mixedMin) {
+    return DeterminantCertified(threadsCount, tuning.tolerance).det;
+  }
+  if (_size >= tuning.tiledMin) return DeterminantTiled(threadsCount);
+  return DeterminantLU(threadsCount);
+}
 
-  vector_t& operator[](size_t i) { return data[i]; };
-  // bool operator==(const Matrix&);
+/*
+  Factors in double and bounds the error of the result from the factors. If
+  the bound is above tolerance, integer matrices are redone exactly and the
+  rest in long double.
+*/
+template<typename T, typename Layout>
+Certified Matrix<T, Layout>::DeterminantCertified(size_t threadsCount, const ld_t tolerance)
+{
+  Certified result;
+  if (size() == 0) return result;
+  if (threadsCount < 1) threadsCount = 1;
+  _threadsCount = threadsCount;
 
-  const size_t size() const { return _size; };
+  Arena::Lease arena(_stats);
+  auto tasks = threadsCount > 1 && _size >= 64 ? threadsCount : 1;
+  auto& columns = arena->Columns(tasks, _size + 1);
+  result.det = DetMixed(arena->Doubles(_size * _size), arena->Swap(_size), columns, result.relativeError, result.singular);
+  if (result.relativeError <= tolerance) return result;
 
-  /*
-    NOT CONST CAUSE OF SHARED PRIVATE VARIABLES
-  */
-  ld_t Determinant(size_t = 1, const Methods = LU);
-  ld_t DeterminantLU(size_t = 1);
-  ld_t DeterminantLaplace(size_t = 1);
+  result.escalated = true;
+  if (std::is_integral<T>::value && DetBareiss(arena->Integers(_size * _size), result.det)) {
+    result.relativeError = fabs(result.det) < std::ldexp(1.0L, std::numeric_limits<ld_t>::digits) ? 0 : std::numeric_limits<ld_t>::epsilon();
+    result.singular = result.det == 0;
+    return result;
+  }
+  result.det = DetMixed(arena->Buffer(_size * _size), arena->Swap(_size), columns, result.relativeError, result.singular);
+  return result;
+}
 
-private:
-  table_t data;
-  const size_t _size;
+/*
+  Row-major LU in W with physical row swaps, so the update runs over
+  contiguous rows. LU is exact for A + E with |E| <= g(3n) |L||U|, so
+  det(A + E) / det(A) = det(I + A^-1 E) and the relative error is at most
+  (1 + h)^n - 1 with h = g(3n) * || |L||U| || * ||A^-1||. ||A^-1|| is taken
+  from the inverse of the factors, with a margin for E and the solves.
+*/
+template<typename T, typename Layout>
+template<typename W>
+ld_t Matrix<T, Layout>::DetMixed(std::vector<W>& lu, vector_s_t& swap, table_ld_t& columns, ld_t& error, bool& singular)
+{
+  const auto n = this->_size;
+  const ld_t u = std::numeric_limits<W>::epsilon() / 2;
+  ForEach([&](size_t i, size_t j, const T v) { lu[i * n + j] = static_cast<W>(v); });
 
-  size_t _perThread = 1;
-  size_t _modThread = 0;
-  size_t _threadsCount = 5;
+  ld_t det = 1;
+  error = std::numeric_limits<ld_t>::infinity();
+  singular = false;
+  for (size_t k = 0; k < n; ++k) {
+    auto p = k;
+    for (auto i = k + 1; i < n; ++i) {
+      if (std::fabs(lu[i * n + k]) > std::fabs(lu[p * n + k])) p = i;
+    }
+    swap[k] = p;
+    if (p != k) {
+      std::swap_ranges(lu.begin() + k * n, lu.begin() + (k + 1) * n, lu.begin() + p * n);
+    }
 
-  ld_t DetRecursive(size_t, size_t, size_t, vector_s_t&);
-  void DetLU(table_ld_t&, vector_s_t&, ld_t&, Barrier&, Barrier&, const size_t = 0);
-};
+    const W pivot = lu[k * n + k];
+    det *= static_cast<ld_t>(pivot) * (2 * (k == p) - 1);
+    if (pivot == 0) {
+      singular = true;
+      return 0;
+    }
+
+    auto update = [&lu, n, k, pivot](size_t from, size_t to) {
+      const W* top = lu.data() + k * n;
+      for (auto i = from; i < to; ++i) {
+        W* row = lu.data() + i * n;
+        const W x = row[k] /= pivot;
+        for (auto j = k + 1; j < n; ++j) {
+          row[j] -= x * top[j];
+        }
+      }
+    };
 
+    auto rows = n - k - 1;
+    if (this->_threadsCount > 1 && rows * rows >= 64 * 64) {
+      TaskGroup group(ThreadPool::Sized(this->_threadsCount));
+      auto chunk = (rows + this->_threadsCount - 1) / this->_threadsCount;
+      for (auto i = k + 1; i < n; i += chunk) {
+        auto to = std::min(i + chunk, n);
+        group.Run([=, &update]() { update(i, to); });
+      }
+      group.Wait();
+    } else {
+      update(k + 1, n);
+    }
+  }
 
-Barrier::Barrier(const size_t count) : _threadCount(count), _counter(0), _waiting(0) {};
+  // || |L||U| ||_1 from the column sums of |L|
+  auto& sums = columns[0];
+  std::fill(sums.begin(), sums.begin() + n, 1);
+  for (size_t i = 0; i < n; ++i) {
+    for (size_t k = 0; k < i; ++k) sums[k] += std::fabs(lu[i * n + k]);
+  }
+  ld_t normLU = 0;
+  for (size_t j = 0; j < n; ++j) {
+    ld_t sum = 0;
+    for (size_t k = 0; k <= j; ++k) {
+      sum += sums[k] * std::fabs(lu[k * n + j]);
+    }
+    normLU = std::max(normLU, sum);
+  }
 
-void Barrier::Wait()
+  // the solves and E move the norm of the inverse by at most a factor of
+  // 1 / (1 - g) with g = (g(3n) + g'(n)) * || |L||U| || * ||(LU)^-1||
+  auto gamma = 3 * n * u / (1 - 3 * n * u);
+  const ld_t v = n * std::numeric_limits<ld_t>::epsilon() / 2;
+  auto inverse = InverseNorm(lu, swap, columns);
+  auto g = (gamma + v / (1 - v)) * normLU * inverse;
+  if (!(g < 1)) {
+    error = std::numeric_limits<ld_t>::infinity();
+    return det;
+  }
+  auto h = gamma * normLU * inverse / (1 - g);
+  error = std::expm1(n * std::log1p(h)) + n * u;
+  if (!std::isfinite(error)) error = std::numeric_limits<ld_t>::infinity();
+  return det;
+}
+
+/*
+  ||A^-1||_1 from the LU factors: every column of the inverse is solved for,
+  O(n^3) like the factorization, so the norm is not an estimate. Columns are
+  split over the pool, each task keeps its largest sum after its scratch.
+*/
+template<typename T, typename Layout>
+template<typename W>
+ld_t Matrix<T, Layout>::InverseNorm(const std::vector<W>& lu, const vector_s_t& swap, table_ld_t& columns)
 {
-  std::unique_lock<std::mutex> lock(_mtx);
-  ++_counter;
-  ++_waiting;
-  _cv.wait(lock, [&]() { return _counter >= _threadCount; });
-  --_waiting;
-  _cv.notify_one();
-  if (_waiting == 0) _counter = 0;
-  lock.unlock();
+  const auto n = this->_size;
+
+  // column c of A^-1 solves L U v = P e_c
+  auto solve = [&](size_t from, size_t to, vector_ld_t& v) {
+    ld_t norm = 0;
+    for (auto c = from; c < to; ++c) {
+      std::fill(v.begin(), v.begin() + n, 0);
+      v[c] = 1;
+      for (size_t k = 0; k < n; ++k) std::swap(v[k], v[ swap[k] ]);
+      for (size_t i = 0; i < n; ++i) {
+        for (size_t j = 0; j < i; ++j) v[i] -= lu[i * n + j] * v[j];
+      }
+      ld_t sum = 0;
+      for (size_t i = n; i-- > 0; ) {
+        for (auto j = i + 1; j < n; ++j) v[i] -= lu[i * n + j] * v[j];
+        v[i] /= lu[i * n + i];
+        sum += fabs(v[i]);
+      }
+      norm = std::max(norm, sum);
+    }
+    v[n] = norm;
+  };
+
+  const auto tasks = columns.size();
+  const auto chunk = (n + tasks - 1) / tasks;
+  if (tasks > 1) {
+    TaskGroup group(ThreadPool::Sized(this->_threadsCount));
+    for (size_t t = 1; t < tasks; ++t) {
+      auto& v = columns[t];
+      group.Run([&solve, &v, t, chunk, n]() { solve(std::min(t * chunk, n), std::min((t + 1) * chunk, n), v); });
+    }
+    solve(0, std::min(chunk, n), columns[0]);
+    group.Wait();
+  } else {
+    solve(0, n, columns[0]);
+  }
+
+  ld_t norm = 0;
+  for (const auto& v : columns) {
+    norm = std::max(norm, v[n]);
+  }
+  return norm;
 }
 
-template<typename T>
-Matrix<T>::Matrix() : data(0), _size(0) {};
+/*
+  Fraction-free elimination, exact for integer matrices. Every intermediate
+  value is a minor of the matrix, gives up if one of them overflows.
+*/
+template<typename T, typename Layout>
+bool Matrix<T, Layout>::DetBareiss(std::vector<__int128>& m, ld_t& result)
+{
+  using wide_t = __int128;
+  const auto n = this->_size;
+  ForEach([&](size_t i, size_t j, const T v) { m[i * n + j] = static_cast<wide_t>(v); });
 
-template<typename T>
-Matrix<T>::Matrix(const size_t n) : data(n, vector_t(n, T())), _size(n) {};
+  wide_t previous = 1;
+  int sign = 1;
+  for (size_t k = 0; k + 1 < n; ++k) {
+    if (m[k * n + k] == 0) {
+      auto p = k + 1;
+      while (p < n && m[p * n + k] == 0) ++p;
+      if (p == n) {
+        result = 0;
+        return true;
+      }
+      std::swap_ranges(m.begin() + k * n, m.begin() + (k + 1) * n, m.begin() + p * n);
+      sign = -sign;
+    }
+    for (auto i = k + 1; i < n; ++i) {
+      for (auto j = k + 1; j < n; ++j) {
+        wide_t a, b;
+        if (__builtin_mul_overflow(m[i * n + j], m[k * n + k], &a)) return false;
+        if (__builtin_mul_overflow(m[i * n + k], m[k * n + j], &b)) return false;
+        if (__builtin_sub_overflow(a, b, &a)) return false;
+        m[i * n + j] = a / previous;
+      }
+    }
+    previous = m[k * n + k];
+  }
+  result = static_cast<ld_t>(m[n * n - 1]) * sign;
+  return true;
+}
 
-template<typename T>
-Matrix<T>::Matrix(const size_t n, const T val) : data(n, vector_t(n, val)), _size(n) {};
+// upper or lower, diagonal counts as both. Each side stops at its first
+// nonzero, starting next to the diagonal where a dense matrix fails at once
+template<typename T, typename Layout>
+bool Matrix<T, Layout>::IsTriangular() const
+{
+  auto zero = [this](bool below) {
+    for (size_t d = 1; d < _size; ++d) {
+      for (size_t i = d; i < _size; ++i) {
+        if ((below ? Element(i, i - d) : Element(i - d, i)) != T()) return false;
+      }
+    }
+    return true;
+  };
+  return zero(true) || zero(false);
+}
 
-template<typename T>
-Matrix<T>::Matrix(const std::initializer_list< std::initializer_list<T> > d) : Matrix(d.size())
+/*
+  Toledo's recursive LU: factor the left half of the panel, bring the right
+  half up to date, factor it and carry its row swaps back to the left half.
+*/
+template<typename T, typename Layout>
+void Matrix<T, Layout>::DetRLU(
+    ld_t*         matrix,
+    vector_s_t&   swap,
+    const size_t  k,
+    const size_t  width)
 {
-  size_t i = 0, j = 0;
-  for (const auto& l : d) {
-    for (const auto& v : l) {
-      data[i][j] = v;
-      ++j;
+  const auto n = this->_size;
+  auto column = matrix + k * n;
+
+  if (this->_token && this->_token->Cancelled()) return;
+
+  if (width == 1) {
+    auto p = k;
+    for (auto i = k + 1; i < n; ++i) {
+      if (fabs(column[i]) > fabs(column[p])) p = i;
     }
-    j = 0;
-    ++i;
+    swap[k] = p;
+    std::swap(column[k], column[p]);
+
+    auto pivot = column[k];
+    if (pivot == 0) return;
+    for (auto i = k + 1; i < n; ++i) {
+      column[i] /= pivot;
+    }
+    return;
   }
-};
 
-template<typename T>
-ld_t Matrix<T>::Determinant(size_t threadsCount, const Methods method)
+  const auto left = width / 2;
+  const auto right = width - left;
+  const auto mid = k + left;
+  DetRLU(matrix, swap, k, left);
+  if (this->_token && this->_token->Cancelled()) return;
+
+  // apply the left half row swaps and solve L11 * U12 = A12, column by column
+  auto solve = [=, &swap](size_t from, size_t to) {
+    for (auto j = from; j < to; ++j) {
+      auto col = matrix + j * n;
+      for (auto i = k; i < mid; ++i) {
+        std::swap(col[i], col[ swap[i] ]);
+      }
+      for (auto p = k; p < mid; ++p) {
+        auto x = col[p];
+        auto l = matrix + p * n;
+        for (auto i = p + 1; i < mid; ++i) {
+          col[i] -= l[i] * x;
+        }
+      }
+    }
+  };
+
+  if (this->_threadsCount > 1 && right > 1) {
+    TaskGroup group(ThreadPool::Sized(this->_threadsCount));
+    auto chunk = std::max(static_cast<size_t>(1), right / this->_threadsCount);
+    for (auto j = mid; j < k + width; j += chunk) {
+      auto to = std::min(j + chunk, k + width);
+      group.Run([=]() { solve(j, to); });
+    }
+    group.Wait();
+  } else {
+    solve(mid, k + width);
+  }
+
+  // A22 -= A21 * U12
+  UpdateRLU(matrix + mid + k * n, matrix + k + mid * n, matrix + mid + mid * n, n - mid, right, left);
+  if (this->_token && this->_token->Cancelled()) return;
+
+  DetRLU(matrix, swap, mid, right);
+  if (this->_token && this->_token->Cancelled()) return;
+
+  for (auto j = k; j < mid; ++j) {
+    auto col = matrix + j * n;
+    for (auto i = mid; i < k + width; ++i) {
+      std::swap(col[i], col[ swap[i] ]);
+    }
+  }
+}
+
+/*
+  C -= A * B for column-major blocks with leading dimension of the matrix.
+  Halves the largest dimension until the block fits in cache, the halves
+  that write disjoint parts of C are forked to a pool of _threadsCount threads.
+*/
+template<typename T, typename Layout>
+void Matrix<T, Layout>::UpdateRLU(
+    const ld_t*   a,
+    const ld_t*   b,
+    ld_t*         c,
+    const size_t  rows,
+    const size_t  cols,
+    const size_t  depth)
 {
-  if (size() == 0) return 0;
-  if (threadsCount < 1) threadsCount = 1;
+  const size_t BASE = 32;
+  const auto n = this->_size;
 
-  if (method == LAPLACE) {
-    return DeterminantLaplace(threadsCount);
+  if (rows <= BASE && cols <= BASE && depth <= BASE) {
+    UpdateKernel(a, b, c, rows, cols, depth);
+    return;
+  }
+  if (this->_token && this->_token->Cancelled()) return;
+
+  bool fork = this->_threadsCount > 1 && rows * cols * depth > BASE * BASE * BASE;
+  if (depth >= rows && depth >= cols) {
+    auto half = depth / 2;
+    UpdateRLU(a, b, c, rows, cols, half);
+    UpdateRLU(a + half * n, b + half, c, rows, cols, depth - half);
+  } else if (rows >= cols) {
+    auto half = rows / 2;
+    if (fork) {
+      TaskGroup group(ThreadPool::Sized(this->_threadsCount));
+      group.Run([=]() { UpdateRLU(a, b, c, half, cols, depth); });
+      UpdateRLU(a + half, b, c + half, rows - half, cols, depth);
+      group.Wait();
+    } else {
+      UpdateRLU(a, b, c, half, cols, depth);
+      UpdateRLU(a + half, b, c + half, rows - half, cols, depth);
+    }
+  } else {
+    auto half = cols / 2;
+    if (fork) {
+      TaskGroup group(ThreadPool::Sized(this->_threadsCount));
+      group.Run([=]() { UpdateRLU(a, b, c, rows, half, depth); });
+      UpdateRLU(a, b + half * n, c + half * n, rows, cols - half, depth);
+      group.Wait();
+    } else {
+      UpdateRLU(a, b, c, rows, half, depth);
+      UpdateRLU(a, b + half * n, c + half * n, rows, cols - half, depth);
+    }
   }
-  return DeterminantLU(threadsCount);
 }
 
-template<typename T>
-ld_t Matrix<T>::DeterminantLU(size_t threadsCount)
+template<typename T, typename Layout>
+void Matrix<T, Layout>::UpdateKernel(
+    const ld_t*   a,
+    const ld_t*   b,
+    ld_t*         c,
+    const size_t  rows,
+    const size_t  cols,
+    const size_t  depth)
+{
+  const auto n = this->_size;
+  Gemm<ld_t>(rows, cols, depth, -1, a, 1, n, b, 1, n, 1, c, 1, n);
+}
+
+/*
+  Tiled LU in the PLASMA style. Every step k is split into tasks:
+    PANEL(k)     factor tile column k with partial pivoting
+    SOLVE(k, j)  apply its swaps to tile column j and compute U(k, j)
+    UPDATE(i, j) A(i, j) -= L(i, k) * U(k, j)
+  and the graph runs each of them as soon as its inputs are ready, so the
+  next panel starts while the rest of the trailing matrix is still updated.
+  Every task checks the token first, so a cancelled graph drains at once.
+*/
+template<typename T, typename Layout>
+ld_t Matrix<T, Layout>::DeterminantTiled(size_t threadsCount, size_t tileSize)
 {
   if (size() == 0) return 0;
   if (threadsCount < 1) threadsCount = 1;
+  if (tileSize < 1) tileSize = 1;
   _threadsCount = threadsCount;
 
-  Barrier s1(threadsCount), s2(threadsCount);
-  ld_t det = 1;
-  vector_s_t swap(_size);
-  table_ld_t matrix(_size, vector_ld_t(_size, 0));
-  for (auto i = 0; i < _size; ++i) {
-    swap[i] = i;
-    for (auto j = 0; j < _size; ++j) {
-      matrix[i][j] = static_cast<ld_t>(data[i][j]);
+  const auto n = _size;
+  const auto tiles = (n + tileSize - 1) / tileSize;
+
+  Arena::Lease arena(_stats);
+  auto& swap = arena->Swap(n);
+  auto& buffer = arena->Buffer(n * n);
+  auto matrix = buffer.data();
+  ForEach([&](size_t i, size_t j, const T v) { matrix[i + j * n] = static_cast<ld_t>(v); });
+
+  auto from = [=](size_t t) { return t * tileSize; };
+  auto to = [=](size_t t) { return std::min((t + 1) * tileSize, n); };
+  auto cancelled = [this]() { return _token && _token->Cancelled(); };
+
+  TaskGraph graph(ThreadPool::Sized(threadsCount));
+  // last task that wrote tile (i, j), tiles x tiles
+  const size_t none = -1;
+  std::vector<size_t> owner(tiles * tiles, none);
+  auto writer = [&](size_t i, size_t j) -> size_t& { return owner[i + j * tiles]; };
+  auto depend = [&](size_t task, size_t i, size_t j) {
+    if (writer(i, j) != none) graph.Depend(task, writer(i, j));
+  };
+
+  for (size_t k = 0; k < tiles; ++k) {
+    auto panel = graph.Add([=, &swap]() {
+      if (cancelled()) return;
+      TilePanel(matrix, swap, from(k), to(k));
+    });
+    for (auto i = k; i < tiles; ++i) {
+      depend(panel, i, k);
+      writer(i, k) = panel;
+    }
+
+    std::vector<size_t> solves(tiles, 0);
+    for (auto j = k + 1; j < tiles; ++j) {
+      auto solve = graph.Add([=, &swap]() {
+        if (cancelled()) return;
+        TileSolve(matrix, swap, from(k), to(k), from(j), to(j));
+      });
+      graph.Depend(solve, panel);
+      for (auto i = k; i < tiles; ++i) {
+        depend(solve, i, j);
+        writer(i, j) = solve;
+      }
+      solves[j] = solve;
     }
-  }
 
-  std::vector< std::thread > ths;
-  for(size_t i = 0; i < threadsCount; ++i) {
-    ths.emplace_back(std::move( std::thread(
-      &Matrix<T>::DetLU, this, std::ref(matrix), std::ref(swap), std::ref(det), std::ref(s1), std::ref(s2), i
-    ) ));
+    for (auto j = k + 1; j < tiles; ++j) {
+      for (auto i = k + 1; i < tiles; ++i) {
+        auto update = graph.Add([=]() {
+          if (cancelled()) return;
+          UpdateKernel(
+            matrix + from(i) + from(k) * n,
+            matrix + from(k) + from(j) * n,
+            matrix + from(i) + from(j) * n,
+            to(i) - from(i), to(j) - from(j), to(k) - from(k)
+          );
+        });
+        graph.Depend(update, solves[j]);
+        writer(i, j) = update;
+      }
+    }
   }
 
-  for (auto& thr : ths) {
-    thr.join();
+  if (threadsCount > 1) {
+    graph.Run();
+  } else {
+    graph.RunInline();
   }
 
-  if (std::isnan(det)) {
-    det = .0;
+  ld_t det = 1;
+  for (size_t k = 0; k < n; ++k) {
+    det *= matrix[k + k * n] * (2 * (swap[k] == k) - 1);
   }
   return det;
 }
 
-template<typename T>
-ld_t Matrix<T>::DeterminantLaplace(size_t threadsCount)
+/*
+  Forks processesCount worker processes, each one keeps only its blocks of a
+  2D block-cyclic layout and they talk through POSIX shared memory. Falls
+  back to DeterminantLU if the processes can't be started or one of them dies.
+  fork() copies only the calling thread, so a lock held by another one stays
+  locked in the ranks. The ranks only read the elements, allocate, which
+  glibc keeps usable after fork(), and use the shared memory, so running
+  thread pools are fine, but the elements must be readable without a lock.
+*/
+template<typename T, typename Layout>
+ld_t Matrix<T, Layout>::DeterminantDistributed(size_t processesCount, size_t blockSize)
 {
   if (size() == 0) return 0;
-  if (threadsCount < 1) threadsCount = 1;
-  _threadsCount = threadsCount;
+  if (processesCount < 1) processesCount = 1;
 
-  _perThread = std::max(static_cast<size_t>(1), size() / threadsCount);
-  _modThread = _size - std::min(_perThread * threadsCount, _size);
-  size_t asyncSize = 0;
+  BlockCyclic layout(_size, processesCount, blockSize);
+  auto bytes = std::max(2 * layout.Count(0, layout.Cols()), layout.Count(0, layout.Rows())) * sizeof(ld_t);
+  SharedMemoryTransport transport(processesCount, bytes);
+  if (!transport.valid()) return DeterminantLU();
+
+  std::vector<pid_t> ranks;
+  for (size_t rank = 0; rank < processesCount; ++rank) {
+    auto pid = fork();
+    // a rank must never unwind into the caller's copied stack
+    if (pid == 0) {
+      try {
+        transport.Attach(rank);
+        auto det = DistributedLU(transport, layout, [this](size_t i, size_t j) {
+          return static_cast<ld_t>(Element(i, j));
+        });
+        if (rank == 0) transport.Result() = det;
+        _exit(0);
+      } catch (...) {
+        _exit(1);
+      }
+    }
+    if (pid < 0) break;
+    ranks.push_back(pid);
+  }
 
-  std::vector< vector_s_t > used(threadsCount, vector_s_t(_size, 0));
+  // a rank that dies leaves the others in the barrier, so they are killed
+  bool failed = ranks.size() < processesCount;
+  std::vector<bool> done(ranks.size(), false);
+  for (size_t running = ranks.size(); running > 0; ) {
+    if (failed) {
+      for (size_t r = 0; r < ranks.size(); ++r) {
+        if (!done[r]) kill(ranks[r], SIGKILL);
+      }
+    }
 
-  std::vector< std::future<ld_t> > ths;
-  for (auto i = 1; i < threadsCount && asyncSize < _size - 1; ++i) {
-    ths.emplace_back(std::move( std::async(
-      std::launch::async, &Matrix<T>::DetRecursive, this, asyncSize, _perThread + (_modThread > 0), 0, std::ref(used[i])
-    ) ));
-    asyncSize += _perThread + (_modThread-- > 0);
+    bool exited = false;
+    for (size_t r = 0; r < ranks.size(); ++r) {
+      if (done[r]) continue;
+      int status = 0;
+      auto pid = waitpid(ranks[r], &status, WNOHANG);
+      if (pid == 0) continue;
+      done[r] = exited = true;
+      --running;
+      failed = failed || pid < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+    }
+    if (!exited) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  if (failed) return DeterminantLU();
+  return transport.Result();
+}
+
+// factors columns [start, end) below the diagonal, swaps stay inside the panel
+template<typename T, typename Layout>
+void Matrix<T, Layout>::TilePanel(
+    ld_t*         matrix,
+    vector_s_t&   swap,
+    const size_t  start,
+    const size_t  end)
+{
+  const auto n = this->_size;
+  for (auto k = start; k < end; ++k) {
+    auto column = matrix + k * n;
+    auto p = k;
+    for (auto i = k + 1; i < n; ++i) {
+      if (fabs(column[i]) > fabs(column[p])) p = i;
+    }
+    swap[k] = p;
+    for (auto j = start; j < end; ++j) {
+      std::swap(matrix[k + j * n], matrix[p + j * n]);
+    }
+
+    auto pivot = column[k];
+    if (pivot == 0) continue;
+    for (auto i = k + 1; i < n; ++i) {
+      column[i] /= pivot;
+    }
+    for (auto j = k + 1; j < end; ++j) {
+      auto col = matrix + j * n;
+      auto x = col[k];
+      for (auto i = k + 1; i < n; ++i) {
+        col[i] -= column[i] * x;
+      }
+    }
   }
+}
 
-  ld_t result = DetRecursive(asyncSize, _size - asyncSize, 0, used[0]);
-  // printf("%Lf ... ", result);
-  for (auto t = ths.begin(); t != ths.end(); ++t) {
-    auto value = t->get();
-    // printf("%Lf, ", value);
-    result += value;
+// swaps of panel [start, end) on columns [from, to), then U = L^-1 * A
+template<typename T, typename Layout>
+void Matrix<T, Layout>::TileSolve(
+    ld_t*              matrix,
+    const vector_s_t&  swap,
+    const size_t       start,
+    const size_t       end,
+    const size_t       from,
+    const size_t       to)
+{
+  const auto n = this->_size;
+  for (auto j = from; j < to; ++j) {
+    auto col = matrix + j * n;
+    for (auto i = start; i < end; ++i) {
+      std::swap(col[i], col[ swap[i] ]);
+    }
+    for (auto p = start; p < end; ++p) {
+      auto x = col[p];
+      auto l = matrix + p * n;
+      for (auto i = p + 1; i < end; ++i) {
+        col[i] -= l[i] * x;
+      }
+    }
   }
-  return result;
 }
 
-template<typename T>
-void Matrix<T>::DetLU(
+template<typename T, typename Layout>
+void Matrix<T, Layout>::DetLU(
     table_ld_t&   matrix,
     vector_s_t&   swap,
     ld_t&         det,
+    Tournament&   pivots,
     Barrier&      s1,
     Barrier&      s2,
     const size_t  threadNumber)
 {
-  for (auto k = 0; k < this->_size; ++k) {
+  const auto n = this->_size;
+  const auto threadsCount = this->_threadsCount;
+
+  // rows [offset, n) are split into contiguous blocks, one per thread
+  size_t start, end;
+  auto block = [&](size_t offset) {
+    auto rows = n - offset;
+    auto perThread = std::max(static_cast<size_t>(1), rows / threadsCount);
+    auto modThread = rows - std::min(perThread * threadsCount, rows);
+    start = std::min(offset + perThread * threadNumber + std::min(modThread, threadNumber), n);
+    end = std::min(start + perThread + (threadNumber < modThread), n);
+  };
+
+  // best candidate of the own block for column k
+  auto offer = [&](size_t k) {
+    ld_t best = -1;
+    size_t row = n;
+    for (auto i = start; i < end; ++i) {
+      auto value = fabs(matrix[ swap[i] ][k]);
+      if (value > best) {
+        best = value;
+        row = i;
+      }
+    }
+    pivots.Offer(threadNumber, best, row);
+  };
+
+  THRD_PROBE( Probe probe(this->_stats ? &this->_stats->threads[threadNumber] : nullptr); )
+
+  block(0);
+  offer(0);
+  THRD_PROBE( probe.Lap(&DetStats::Thread::pivot); )
+  s2.Wait();
+  THRD_PROBE( probe.Lap(&DetStats::Thread::barrier); )
+
+  for (size_t k = 0; k < n; ++k) {
     auto offset = k + 1;
 
     if (threadNumber == 0) {
-      // find max pivot in k-column
-      auto p = k;
-      for (auto i = p + 1; i < this->_size; ++i) {
-        if ( fabs(matrix[ swap[i] ][k]) - fabs(matrix[ swap[p] ][k]) > EPS ) {
-          p = i;
-        }
-      }
+      auto p = pivots.Winner();
 
       // swap rows
       auto foo = swap[k];
@@ -224,38 +1780,42 @@ void Matrix<T>::DetLU(
       swap[p] = foo;
 
       // calc det
-      auto pivot = matrix[ swap[k] ][k];
-      for (auto i = offset; i < this->_size; ++i) {
-        matrix[ swap[i] ][k] /= pivot;
-      }
-      det *= pivot * (2 * (k == p) - 1);
-
-      auto tmpSize = this->_size - offset;
-      this->_perThread = std::max(static_cast<size_t>(1), tmpSize / this->_threadsCount);
-      this->_modThread = tmpSize - std::min(this->_perThread * this->_threadsCount, tmpSize);
+      det *= matrix[ swap[k] ][k] * (2 * (k == p) - 1);
+      this->_aborted = this->_token && this->_token->Cancelled();
+      THRD_PROBE( probe.Lap(&DetStats::Thread::pivot); )
     }
 
     s1.Wait();
+    THRD_PROBE( probe.Lap(&DetStats::Thread::barrier); )
+    if (this->_aborted) break;
 
-    // update matrix
-    size_t start = offset + this->_perThread * threadNumber + std::min(this->_modThread, threadNumber);
-    size_t end = std::min(start + this->_perThread + (threadNumber < this->_modThread), this->_size);
+    // update matrix and look for the next pivot in the same rows
+    auto pivot = matrix[ swap[k] ][k];
+    block(offset);
 
     for (auto i = start; i < end; ++i) {
-      double x = matrix[ swap[i] ][k];
-      for (auto j = offset; j < this->_size; ++j) {
-        matrix[ swap[i] ][j] -= x * matrix[ swap[k] ][j];
+      if (pivot == 0) break;
+
+      auto& row = matrix[ swap[i] ];
+      ld_t x = row[k] /= pivot;
+      for (auto j = offset; j < n; ++j) {
+        row[j] -= x * matrix[ swap[k] ][j];
       }
     }
+    THRD_PROBE(
+      if (pivot != 0) probe.Rows(end - start, n - offset);
+      probe.Lap(&DetStats::Thread::update);
+    )
+    if (offset < n) offer(offset);
+    THRD_PROBE( probe.Lap(&DetStats::Thread::pivot); )
 
     s2.Wait();
-    // if (threadNumber == 0) std::this_thread::sleep_for(std::chrono::milliseconds(5));
-    // std::this_thread::sleep_for(std::chrono::nanoseconds(100));
+    THRD_PROBE( probe.Lap(&DetStats::Thread::barrier); )
   }
 }
 
-template<typename T>
-ld_t Matrix<T>::DetRecursive(
+template<typename T, typename Layout>
+ld_t Matrix<T, Layout>::DetRecursive(
     size_t       start,
     size_t       count,
     size_t       row,
@@ -268,6 +1828,11 @@ ld_t Matrix<T>::DetRecursive(
   //   printf("D[] %d -> %d\n", start, end);
   // }
 
+  // the clock is only read near the root, leaves are too many
+  if (this->_token && row + 6 < this->_size && this->_token->Cancelled()) {
+    return 0;
+  }
+
   if (row >= this->_size) {
     // throw Exception();
     // printf("EXCEPTION SIZE\n");
@@ -282,7 +1847,7 @@ ld_t Matrix<T>::DetRecursive(
 
   if (row == this->_size - 1) {
     for (auto i = start; i < end; ++i) {
-      if (used[i] == 0) return this->data[row][i];
+      if (used[i] == 0) return this->Element(row, i);
     }
     // throw Exception();
     // printf("EXCEPTION AVAILABILITY: %d\n", used);
@@ -295,13 +1860,119 @@ ld_t Matrix<T>::DetRecursive(
     if (used[i] > 0) continue;
 
     used[i] = 1;
-    det += k * this->data[row][i] * DetRecursive(0, len, row + 1, used);
+    det += k * this->Element(row, i) * DetRecursive(0, len, row + 1, used);
     used[i] = 0;
     k = -k;
   }
   return det;
 }
 
+std::string Tuning::Path()
+{
+  auto path = std::getenv("THRD_TUNING");
+  return path ? path : "tuning.txt";
+}
+
+Tuning& Tuning::Get()
+{
+  static Tuning tuning;
+  static std::once_flag loaded;
+  std::call_once(loaded, []() { tuning.Load(Path()); });
+  return tuning;
+}
+
+bool Tuning::Load(const std::string& path)
+{
+  std::ifstream in(path);
+  if (!in) return false;
+
+  std::string key;
+  double value;
+  while (in >> key >> value) {
+    if (key == "laplaceMax") laplaceMax = value;
+    else if (key == "serialMax") serialMax = value;
+    else if (key == "rowsPerThread") rowsPerThread = value;
+    else if (key == "tiledMin") tiledMin = value;
+    else if (key == "mixedMin") mixedMin = value;
+    else if (key == "tolerance") tolerance = value;
+  }
+  return true;
+}
+
+bool Tuning::Save(const std::string& path) const
+{
+  std::ofstream out(path, std::ofstream::trunc);
+  out << "laplaceMax " << laplaceMax << std::endl;
+  out << "serialMax " << serialMax << std::endl;
+  out << "rowsPerThread " << rowsPerThread << std::endl;
+  out << "tiledMin " << tiledMin << std::endl;
+  out << "mixedMin " << mixedMin << std::endl;
+  out << "tolerance " << tolerance << std::endl;
+  return static_cast<bool>(out);
+}
+
+/*
+  Times the methods against each other on random matrices of growing size
+  and takes the first size where the next method wins.
+*/
+Tuning Tuning::Calibrate(size_t threadsCount)
+{
+  using clock = std::chrono::steady_clock;
+  if (threadsCount < 1) threadsCount = std::max(std::thread::hardware_concurrency(), 1u);
+
+  auto random = [](size_t n) {
+    Matrix<ld_t> M(n);
+    unsigned long long seed = n * 2654435761ull;
+    for (size_t i = 0; i < n; ++i) {
+      for (size_t j = 0; j < n; ++j) {
+        seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+        M[i][j] = static_cast<ld_t>(seed >> 40) / (1 << 24) - 0.5;
+      }
+    }
+    return M;
+  };
+  auto time = [](std::function<void()> f, size_t repeats) {
+    auto start = clock::now();
+    for (size_t i = 0; i < repeats; ++i) f();
+    return std::chrono::duration<double>(clock::now() - start).count() / repeats;
+  };
+
+  Tuning tuning;
+  for (size_t n = 2; n <= 8; ++n) {
+    auto M = random(n);
+    auto laplace = time([&]() { M.DeterminantLaplace(1); }, n < 7 ? 200 : 5);
+    auto lu = time([&]() { M.DeterminantLU(1); }, n < 7 ? 200 : 5);
+    if (laplace > lu) break;
+    tuning.laplaceMax = n;
+  }
+
+  tuning.serialMax = 1024;
+  for (size_t n = 16; n <= 1024 && threadsCount > 1; n *= 2) {
+    auto M = random(n);
+    auto repeats = std::max(static_cast<size_t>(1), (1 << 18) / (n * n));
+    auto serial = time([&]() { M.DeterminantLU(1); }, repeats);
+    auto parallel = time([&]() { M.DeterminantLU(threadsCount); }, repeats);
+    if (parallel < serial) {
+      tuning.serialMax = n / 2;
+      break;
+    }
+  }
+  tuning.rowsPerThread = std::max(tuning.serialMax / 2, static_cast<size_t>(16));
+
+  tuning.tiledMin = 2048;
+  for (size_t n = 64; n <= 1024; n *= 2) {
+    auto M = random(n);
+    auto repeats = std::max(static_cast<size_t>(1), (1 << 18) / (n * n));
+    auto lu = time([&]() { M.DeterminantLU(threadsCount); }, repeats);
+    auto tiled = time([&]() { M.DeterminantTiled(threadsCount); }, repeats);
+    if (tiled < lu) {
+      tuning.tiledMin = n;
+      break;
+    }
+  }
+  return tuning;
+}
+
 // template<typename T>
 // T Matrix<T>::Determinant(vector_s_t& jumps, size_t dim)
 // {
@@ -0,0 +1,320 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+
+namespace thrd {
+
+typedef long double ld_t;
+
+
+/*
+  Collective operations between the ranks of a distributed run. The LU below
+  only talks to its peers through this interface, so the processes can be
+  connected by anything: shared memory, sockets or MPI.
+*/
+class Transport
+{
+public:
+  virtual ~Transport() = default;
+
+  virtual size_t Rank() const = 0;
+  virtual size_t Size() const = 0;
+
+  virtual void Barrier() = 0;
+  // every rank sends bytes from the first buffer, all ranks receive Size() * bytes in rank order
+  virtual void AllGather(const void*, void*, const size_t) = 0;
+};
+
+
+/*
+  Ranks are processes forked from the one that created the transport. They
+  share a POSIX shared memory segment with a process-shared barrier and one
+  slot per rank.
+*/
+class SharedMemoryTransport : public Transport
+{
+public:
+  SharedMemoryTransport(const size_t ranks, const size_t bytes);
+  virtual ~SharedMemoryTransport();
+
+  const bool valid() const { return _header != nullptr; };
+  void Attach(const size_t rank) { _rank = rank; };
+
+  size_t Rank() const override { return _rank; };
+  size_t Size() const override { return _ranks; };
+
+  void Barrier() override;
+  void AllGather(const void*, void*, const size_t) override;
+
+  ld_t& Result() { return _header->result; };
+
+private:
+  struct Header
+  {
+    pthread_barrier_t barrier;
+    ld_t result;
+  };
+
+  std::string _name;
+  Header* _header;
+  char* _slots;
+  size_t _length;
+  size_t _bytes;
+  size_t _ranks;
+  size_t _rank;
+};
+
+
+/*
+  2D block-cyclic distribution as in ScaLAPACK: ranks form a rows x cols grid
+  and block (I, J) of the matrix lives on rank (I % rows, J % cols).
+*/
+class BlockCyclic
+{
+public:
+  BlockCyclic(const size_t n, const size_t ranks, const size_t block);
+  virtual ~BlockCyclic() = default;
+
+  const size_t size() const { return _size; };
+  const size_t Rows() const { return _rows; };
+  const size_t Cols() const { return _cols; };
+
+  const size_t Owner(const size_t i, const size_t grid) const { return (i / _block) % grid; };
+  const size_t Local(const size_t i, const size_t grid) const;
+  const size_t Global(const size_t local, const size_t coord, const size_t grid) const;
+  const size_t Count(const size_t coord, const size_t grid) const;
+
+private:
+  size_t _size;
+  size_t _block;
+  size_t _rows;
+  size_t _cols;
+};
+
+
+ld_t DistributedLU(Transport&, const BlockCyclic&, const std::function<ld_t(size_t, size_t)>&);
+
+
+SharedMemoryTransport::SharedMemoryTransport(const size_t ranks, const size_t bytes)
+  : _header(nullptr), _slots(nullptr), _length(0), _bytes(bytes), _ranks(ranks), _rank(0)
+{
+  static std::atomic<size_t> counter(0);
+  _name = "/thrd-det-" + std::to_string(getpid()) + "-" + std::to_string(counter++);
+  _length = sizeof(Header) + ranks * bytes;
+
+  int fd = shm_open(_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0) return;
+
+  void* memory = MAP_FAILED;
+  if (ftruncate(fd, _length) == 0) {
+    memory = mmap(nullptr, _length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (memory == MAP_FAILED) {
+    shm_unlink(_name.c_str());
+    return;
+  }
+
+  _header = static_cast<Header*>(memory);
+  _slots = static_cast<char*>(memory) + sizeof(Header);
+
+  pthread_barrierattr_t attr;
+  pthread_barrierattr_init(&attr);
+  pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  pthread_barrier_init(&_header->barrier, &attr, ranks);
+  pthread_barrierattr_destroy(&attr);
+  _header->result = 0;
+}
+
+SharedMemoryTransport::~SharedMemoryTransport()
+{
+  if (_header == nullptr) return;
+
+  // only the creator cleans up, forked ranks leave with _exit()
+  pthread_barrier_destroy(&_header->barrier);
+  munmap(_header, _length);
+  shm_unlink(_name.c_str());
+}
+
+void SharedMemoryTransport::Barrier()
+{
+  pthread_barrier_wait(&_header->barrier);
+}
+
+void SharedMemoryTransport::AllGather(const void* mine, void* all, const size_t bytes)
+{
+  std::memcpy(_slots + _rank * _bytes, mine, std::min(bytes, _bytes));
+  Barrier();
+  for (size_t r = 0; r < _ranks; ++r) {
+    std::memcpy(static_cast<char*>(all) + r * bytes, _slots + r * _bytes, std::min(bytes, _bytes));
+  }
+  Barrier();
+}
+
+BlockCyclic::BlockCyclic(const size_t n, const size_t ranks, const size_t block)
+  : _size(n), _block(std::max(block, static_cast<size_t>(1))), _rows(1), _cols(1)
+{
+  // the most square grid
+  for (size_t r = 1; r * r <= ranks; ++r) {
+    if (ranks % r == 0) _rows = r;
+  }
+  _cols = std::max(ranks, static_cast<size_t>(1)) / _rows;
+}
+
+const size_t BlockCyclic::Local(const size_t i, const size_t grid) const
+{
+  return (i / (_block * grid)) * _block + i % _block;
+}
+
+const size_t BlockCyclic::Global(const size_t local, const size_t coord, const size_t grid) const
+{
+  return ((local / _block) * grid + coord) * _block + local % _block;
+}
+
+const size_t BlockCyclic::Count(const size_t coord, const size_t grid) const
+{
+  auto cycle = _block * grid;
+  auto rest = _size % cycle;
+  auto tail = rest > coord * _block ? std::min(_block, rest - coord * _block) : 0;
+  return (_size / cycle) * _block + tail;
+}
+
+/*
+  Right-looking LU with partial pivoting, run by every rank on its own blocks.
+  For each column the ranks gather the pivot candidates, the two rows being
+  swapped and the pivot column, then update their blocks of the trailing
+  matrix. All ranks see the same pivots, so all of them return the same value.
+*/
+ld_t DistributedLU(
+    Transport&                                   transport,
+    const BlockCyclic&                           layout,
+    const std::function<ld_t(size_t, size_t)>&  element)
+{
+  const auto n = layout.size();
+  const auto ranks = transport.Size();
+  const auto gridRows = layout.Rows();
+  const auto gridCols = layout.Cols();
+  const auto pr = transport.Rank() / gridCols;
+  const auto pc = transport.Rank() % gridCols;
+  const auto rows = layout.Count(pr, gridRows);
+  const auto cols = layout.Count(pc, gridCols);
+  const auto maxRows = layout.Count(0, gridRows);
+  const auto maxCols = layout.Count(0, gridCols);
+
+  // own blocks, column-major
+  std::vector<ld_t> local(rows * cols);
+  for (size_t lj = 0; lj < cols; ++lj) {
+    for (size_t li = 0; li < rows; ++li) {
+      local[li + lj * rows] = element(layout.Global(li, pr, gridRows), layout.Global(lj, pc, gridCols));
+    }
+  }
+
+  std::vector<ld_t> send(std::max(2 * maxCols, maxRows));
+  std::vector<ld_t> recv(ranks * send.size());
+  std::vector<ld_t> rowK(n), rowP(n), column(n);
+  ld_t candidate[2];
+  std::vector<ld_t> candidates(2 * ranks);
+
+  ld_t det = 1;
+  for (size_t k = 0; k < n; ++k) {
+    // pivot candidates from the ranks owning column k
+    candidate[0] = -1;
+    candidate[1] = n;
+    if (layout.Owner(k, gridCols) == pc) {
+      auto lj = layout.Local(k, gridCols);
+      for (size_t li = 0; li < rows; ++li) {
+        auto i = layout.Global(li, pr, gridRows);
+        auto value = std::fabs(local[li + lj * rows]);
+        if (i >= k && (value > candidate[0] || (value == candidate[0] && i < candidate[1]))) {
+          candidate[0] = value;
+          candidate[1] = i;
+        }
+      }
+    }
+    transport.AllGather(candidate, candidates.data(), sizeof(candidate));
+
+    size_t p = k;
+    ld_t best = -1;
+    for (size_t r = 0; r < ranks; ++r) {
+      auto value = candidates[2 * r];
+      auto i = static_cast<size_t>(candidates[2 * r + 1]);
+      if (value > best || (value == best && i < p)) {
+        best = value;
+        p = i;
+      }
+    }
+    if (best <= 0) return 0;
+
+    // rows k and p, gathered from the ranks of their grid rows
+    auto ownerK = layout.Owner(k, gridRows);
+    auto ownerP = layout.Owner(p, gridRows);
+    for (size_t lj = 0; lj < cols; ++lj) {
+      if (ownerK == pr) send[lj] = local[layout.Local(k, gridRows) + lj * rows];
+      if (ownerP == pr) send[maxCols + lj] = local[layout.Local(p, gridRows) + lj * rows];
+    }
+    transport.AllGather(send.data(), recv.data(), send.size() * sizeof(ld_t));
+    for (size_t r = 0; r < ranks; ++r) {
+      auto rc = r % gridCols;
+      auto slot = recv.data() + r * send.size();
+      for (size_t lj = 0; lj < layout.Count(rc, gridCols); ++lj) {
+        auto j = layout.Global(lj, rc, gridCols);
+        if (r / gridCols == ownerK) rowK[j] = slot[lj];
+        if (r / gridCols == ownerP) rowP[j] = slot[maxCols + lj];
+      }
+    }
+
+    for (size_t lj = 0; lj < cols; ++lj) {
+      auto j = layout.Global(lj, pc, gridCols);
+      if (ownerK == pr) local[layout.Local(k, gridRows) + lj * rows] = rowP[j];
+      if (ownerP == pr && p != k) local[layout.Local(p, gridRows) + lj * rows] = rowK[j];
+    }
+
+    auto pivot = rowP[k];
+    det *= pivot * (2 * (k == p) - 1);
+
+    // pivot column, gathered from the ranks of its grid column
+    auto ownerC = layout.Owner(k, gridCols);
+    if (ownerC == pc) {
+      auto lj = layout.Local(k, gridCols);
+      for (size_t li = 0; li < rows; ++li) {
+        send[li] = local[li + lj * rows];
+      }
+    }
+    transport.AllGather(send.data(), recv.data(), send.size() * sizeof(ld_t));
+    for (size_t r = 0; r < ranks; ++r) {
+      if (r % gridCols != ownerC) continue;
+      auto rr = r / gridCols;
+      auto slot = recv.data() + r * send.size();
+      for (size_t li = 0; li < layout.Count(rr, gridRows); ++li) {
+        column[layout.Global(li, rr, gridRows)] = slot[li];
+      }
+    }
+
+    // update own blocks of the trailing matrix
+    for (size_t lj = 0; lj < cols; ++lj) {
+      auto j = layout.Global(lj, pc, gridCols);
+      if (j <= k) continue;
+      auto u = rowP[j];
+      for (size_t li = 0; li < rows; ++li) {
+        auto i = layout.Global(li, pr, gridRows);
+        if (i <= k) continue;
+        local[li + lj * rows] -= column[i] / pivot * u;
+      }
+    }
+  }
+  return det;
+}
+
+} // namespace thrd
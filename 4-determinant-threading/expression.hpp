@@ -0,0 +1,206 @@
+#pragma once
+
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+
+#include "pool.hpp"
+#include "layout.hpp"
+
+
+namespace thrd {
+
+template<typename T, typename Layout = RowMajor> class Matrix;
+
+
+/*
+  Lazy matrix arithmetic. Sums, differences and scaling only describe the
+  result and a Matrix built from an expression computes every element in one
+  parallel pass, without temporaries. Products can't be fused elementwise,
+  they are computed once with Gemm when the product node is created, on all
+  cores for operator* and on threadsCount threads for Multiply().
+*/
+template<typename E>
+class Expression
+{
+public:
+  const E& self() const { return static_cast<const E&>(*this); };
+  const size_t size() const { return self().size(); };
+};
+
+
+// matrices are kept by reference, expression nodes are small and kept by value
+template<typename E>
+struct Operand
+{
+  using type = const E;
+};
+
+template<typename T, typename L>
+struct Operand< Matrix<T, L> >
+{
+  using type = const Matrix<T, L>&;
+};
+
+
+struct Plus
+{
+  template<typename A, typename B>
+  static auto Apply(const A a, const B b) -> decltype(a + b) { return a + b; };
+};
+
+struct Minus
+{
+  template<typename A, typename B>
+  static auto Apply(const A a, const B b) -> decltype(a - b) { return a - b; };
+};
+
+
+template<typename L, typename R, typename Op>
+class Elementwise : public Expression< Elementwise<L, R, Op> >
+{
+public:
+  using value_type = typename std::common_type<typename L::value_type, typename R::value_type>::type;
+
+  Elementwise(const L& l, const R& r) : _l(l), _r(r)
+  {
+    if (l.size() != r.size()) {
+      throw std::invalid_argument("matrix sizes don't match");
+    }
+  };
+
+  const size_t size() const { return _l.size(); };
+  value_type operator()(const size_t i, const size_t j) const { return Op::Apply(_l(i, j), _r(i, j)); };
+
+private:
+  typename Operand<L>::type _l;
+  typename Operand<R>::type _r;
+};
+
+
+template<typename E, typename S>
+class Scaled : public Expression< Scaled<E, S> >
+{
+public:
+  using value_type = typename std::common_type<typename E::value_type, S>::type;
+
+  Scaled(const E& e, const S scale) : _e(e), _scale(scale) {};
+
+  const size_t size() const { return _e.size(); };
+  value_type operator()(const size_t i, const size_t j) const { return _scale * _e(i, j); };
+
+private:
+  typename Operand<E>::type _e;
+  const S _scale;
+};
+
+
+template<typename L, typename R>
+class Product : public Expression< Product<L, R> >
+{
+public:
+  using value_type = typename std::common_type<typename L::value_type, typename R::value_type>::type;
+  using matrix_t = Matrix<value_type>;
+
+  // 0 threads means all cores
+  Product(const L&, const R&, size_t = 0);
+
+  const size_t size() const { return _result->size(); };
+  value_type operator()(const size_t i, const size_t j) const { return (*_result)(i, j); };
+
+  const std::shared_ptr<matrix_t>& Result() const { return _result; };
+
+private:
+  std::shared_ptr<matrix_t> _result;
+};
+
+
+// a matrix of type V with the value of e, shares e if it already is one
+template<typename V, typename E>
+std::shared_ptr< const Matrix<V> > Materialize(const Expression<E>& e)
+{
+  return std::make_shared< const Matrix<V> >(e);
+}
+
+template<typename V>
+std::shared_ptr< const Matrix<V> > Materialize(const Expression< Matrix<V> >& e)
+{
+  return std::shared_ptr< const Matrix<V> >(std::shared_ptr<void>(), &e.self());
+}
+
+template<typename V, typename L, typename R>
+std::shared_ptr< const Matrix<V> > Materialize(const Expression< Product<L, R> >& e)
+{
+  return Materialize<V>(*e.self().Result());
+}
+
+template<typename E>
+std::shared_ptr< Matrix<typename E::value_type> > Evaluate(const Expression<E>& e)
+{
+  return std::make_shared< Matrix<typename E::value_type> >(e);
+}
+
+template<typename L, typename R>
+std::shared_ptr< typename Product<L, R>::matrix_t > Evaluate(const Product<L, R>& e)
+{
+  return e.Result();
+}
+
+
+template<typename L, typename R>
+Product<L, R>::Product(const L& l, const R& r, size_t threadsCount)
+{
+  if (l.size() != r.size()) {
+    throw std::invalid_argument("matrix sizes don't match");
+  }
+
+  auto a = Materialize<value_type>(l);
+  auto b = Materialize<value_type>(r);
+  if (threadsCount < 1) threadsCount = std::max(std::thread::hardware_concurrency(), 1u);
+  _result = std::make_shared<matrix_t>(a->Multiply(*b, threadsCount));
+}
+
+
+template<typename L, typename R>
+Elementwise<L, R, Plus> operator+(const Expression<L>& l, const Expression<R>& r)
+{
+  return Elementwise<L, R, Plus>(l.self(), r.self());
+}
+
+template<typename L, typename R>
+Elementwise<L, R, Minus> operator-(const Expression<L>& l, const Expression<R>& r)
+{
+  return Elementwise<L, R, Minus>(l.self(), r.self());
+}
+
+template<typename E, typename S, typename = typename std::enable_if< std::is_arithmetic<S>::value >::type>
+Scaled<E, S> operator*(const S scale, const Expression<E>& e)
+{
+  return Scaled<E, S>(e.self(), scale);
+}
+
+template<typename E, typename S, typename = typename std::enable_if< std::is_arithmetic<S>::value >::type>
+Scaled<E, S> operator*(const Expression<E>& e, const S scale)
+{
+  return Scaled<E, S>(e.self(), scale);
+}
+
+template<typename E>
+Scaled<E, int> operator-(const Expression<E>& e)
+{
+  return Scaled<E, int>(e.self(), -1);
+}
+
+template<typename L, typename R>
+Product<L, R> operator*(const Expression<L>& l, const Expression<R>& r)
+{
+  return Product<L, R>(l.self(), r.self());
+}
+
+template<typename L, typename R>
+Product<L, R> Multiply(const Expression<L>& l, const Expression<R>& r, size_t threadsCount)
+{
+  return Product<L, R>(l.self(), r.self(), threadsCount);
+}
+
+} // namespace thrd
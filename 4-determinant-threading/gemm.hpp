@@ -0,0 +1,259 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "pool.hpp"
+
+
+namespace thrd {
+
+/*
+  Register and cache blocking of the GEMM. MR x NR accumulators stay in
+  registers, a KC x NR sliver of B stays in L1, an MC x KC block of A in L2
+  and a KC x NC panel of B in L3.
+*/
+template<typename T>
+struct GemmBlocking
+{
+  static const size_t MR = 4;
+  static const size_t NR = 4;
+  static const size_t KC = 256;
+  static const size_t MC = 64;
+  static const size_t NC = 2048;
+};
+
+template<>
+struct GemmBlocking<double>
+{
+  static const size_t MR = 4;
+  static const size_t NR = 8;
+  static const size_t KC = 256;
+  static const size_t MC = 128;
+  static const size_t NC = 4096;
+};
+
+// x87 has only eight registers
+template<>
+struct GemmBlocking<long double>
+{
+  static const size_t MR = 2;
+  static const size_t NR = 2;
+  static const size_t KC = 128;
+  static const size_t MC = 64;
+  static const size_t NC = 1024;
+};
+
+
+/*
+  C = alpha * A * B + beta * C, BLIS style. A is m x k, B is k x n, C is m x n,
+  each given by a pointer and its row and column strides, so row-major,
+  column-major and submatrices all work. Packs A blocks and B panels into
+  contiguous slivers and runs a register-blocked micro-kernel over them. The
+  MC blocks of A are spread over a pool of threadsCount threads when it is
+  above 1.
+*/
+template<typename T>
+void Gemm(
+    const size_t m, const size_t n, const size_t k,
+    const T alpha,
+    const T* a, const size_t rsa, const size_t csa,
+    const T* b, const size_t rsb, const size_t csb,
+    const T beta,
+    T* c, const size_t rsc, const size_t csc,
+    const size_t threadsCount = 1);
+
+
+template<typename T>
+void GemmPackA(const size_t mc, const size_t kc, const T* a, const size_t rsa, const size_t csa, T* packed)
+{
+  const auto MR = GemmBlocking<T>::MR;
+  for (size_t ir = 0; ir < mc; ir += MR) {
+    auto mr = std::min(MR, mc - ir);
+    for (size_t p = 0; p < kc; ++p) {
+      for (size_t i = 0; i < MR; ++i) {
+        *packed++ = i < mr ? a[(ir + i) * rsa + p * csa] : T();
+      }
+    }
+  }
+}
+
+template<typename T>
+void GemmPackB(const size_t kc, const size_t nc, const T* b, const size_t rsb, const size_t csb, T* packed)
+{
+  const auto NR = GemmBlocking<T>::NR;
+  for (size_t jr = 0; jr < nc; jr += NR) {
+    auto nr = std::min(NR, nc - jr);
+    for (size_t p = 0; p < kc; ++p) {
+      for (size_t j = 0; j < NR; ++j) {
+        *packed++ = j < nr ? b[p * rsb + (jr + j) * csb] : T();
+      }
+    }
+  }
+}
+
+// MR x NR block of C from an MR sliver of A and an NR sliver of B
+template<typename T>
+void GemmKernel(
+    const size_t kc, const T* a, const T* b,
+    const size_t mr, const size_t nr,
+    const T alpha, const T beta,
+    T* c, const size_t rsc, const size_t csc)
+{
+  const auto MR = GemmBlocking<T>::MR;
+  const auto NR = GemmBlocking<T>::NR;
+
+  T acc[MR][NR];
+  for (size_t i = 0; i < MR; ++i) {
+    for (size_t j = 0; j < NR; ++j) {
+      acc[i][j] = T();
+    }
+  }
+
+  for (size_t p = 0; p < kc; ++p, a += MR, b += NR) {
+    for (size_t i = 0; i < MR; ++i) {
+      for (size_t j = 0; j < NR; ++j) {
+        acc[i][j] += a[i] * b[j];
+      }
+    }
+  }
+
+  for (size_t i = 0; i < mr; ++i) {
+    for (size_t j = 0; j < nr; ++j) {
+      auto& x = c[i * rsc + j * csc];
+      x = beta == T() ? alpha * acc[i][j] : alpha * acc[i][j] + beta * x;
+    }
+  }
+}
+
+#ifdef __GNUC__
+/*
+  The double 4 x 8 kernel with explicit vectors: a row of the block is two
+  4-wide accumulators, B is loaded as vectors and A broadcast. GCC maps them
+  to AVX registers with -mavx and to pairs of SSE2 ones otherwise, at any
+  optimization level. Other types use the scalar kernel above.
+*/
+inline void GemmKernel(
+    const size_t kc, const double* a, const double* b,
+    const size_t mr, const size_t nr,
+    const double alpha, const double beta,
+    double* c, const size_t rsc, const size_t csc)
+{
+  typedef double v4d __attribute__((vector_size(4 * sizeof(double))));
+  static_assert(GemmBlocking<double>::MR == 4 && GemmBlocking<double>::NR == 8, "the kernel is 4 x 8");
+
+  v4d acc[4][2] = {};
+  for (size_t p = 0; p < kc; ++p, a += 4, b += 8) {
+    v4d b0, b1;
+    std::memcpy(&b0, b, sizeof(b0));
+    std::memcpy(&b1, b + 4, sizeof(b1));
+    for (size_t i = 0; i < 4; ++i) {
+      acc[i][0] += a[i] * b0;
+      acc[i][1] += a[i] * b1;
+    }
+  }
+
+  for (size_t i = 0; i < mr; ++i) {
+    for (size_t j = 0; j < nr; ++j) {
+      auto x = acc[i][j / 4][j % 4];
+      auto& y = c[i * rsc + j * csc];
+      y = beta == 0 ? alpha * x : alpha * x + beta * y;
+    }
+  }
+}
+#endif
+
+template<typename T>
+void GemmBlock(
+    const size_t mc, const size_t nc, const size_t kc,
+    const T alpha,
+    const T* a, const size_t rsa, const size_t csa,
+    const T* packedB,
+    const T beta,
+    T* c, const size_t rsc, const size_t csc)
+{
+  const auto MR = GemmBlocking<T>::MR;
+  const auto NR = GemmBlocking<T>::NR;
+
+  thread_local std::vector<T> packedA;
+  packedA.resize(((mc + MR - 1) / MR) * MR * kc);
+  GemmPackA(mc, kc, a, rsa, csa, packedA.data());
+
+  for (size_t jr = 0; jr < nc; jr += NR) {
+    for (size_t ir = 0; ir < mc; ir += MR) {
+      GemmKernel(
+        kc, packedA.data() + ir * kc, packedB + jr * kc,
+        std::min(MR, mc - ir), std::min(NR, nc - jr),
+        alpha, beta, c + ir * rsc + jr * csc, rsc, csc
+      );
+    }
+  }
+}
+
+template<typename T>
+void Gemm(
+    const size_t m, const size_t n, const size_t k,
+    const T alpha,
+    const T* a, const size_t rsa, const size_t csa,
+    const T* b, const size_t rsb, const size_t csb,
+    const T beta,
+    T* c, const size_t rsc, const size_t csc,
+    const size_t threadsCount)
+{
+  const auto NR = GemmBlocking<T>::NR;
+  const auto KC = GemmBlocking<T>::KC;
+  const auto MC = GemmBlocking<T>::MC;
+  const auto NC = GemmBlocking<T>::NC;
+
+  if (m == 0 || n == 0) return;
+  if (k == 0) {
+    for (size_t i = 0; i < m; ++i) {
+      for (size_t j = 0; j < n; ++j) {
+        c[i * rsc + j * csc] = beta == T() ? T() : beta * c[i * rsc + j * csc];
+      }
+    }
+    return;
+  }
+
+  // the caller helps the pool while waiting and may run another Gemm meanwhile,
+  // so a parallel call can't share the thread's B panel
+  thread_local std::vector<T> localB;
+  std::vector<T> ownB;
+  auto& packedB = threadsCount > 1 ? ownB : localB;
+
+  for (size_t jc = 0; jc < n; jc += NC) {
+    auto nc = std::min(NC, n - jc);
+    for (size_t pc = 0; pc < k; pc += KC) {
+      auto kc = std::min(KC, k - pc);
+      auto scale = pc == 0 ? beta : T(1);
+
+      packedB.resize(((nc + NR - 1) / NR) * NR * kc);
+      GemmPackB(kc, nc, b + pc * rsb + jc * csb, rsb, csb, packedB.data());
+      const T* panel = packedB.data();
+
+      auto block = [=](size_t ic) {
+        GemmBlock(
+          std::min(MC, m - ic), nc, kc, alpha,
+          a + ic * rsa + pc * csa, rsa, csa, panel,
+          scale, c + ic * rsc + jc * csc, rsc, csc
+        );
+      };
+
+      if (threadsCount > 1 && m > MC) {
+        TaskGroup group(ThreadPool::Sized(threadsCount));
+        for (size_t ic = MC; ic < m; ic += MC) {
+          group.Run([=]() { block(ic); });
+        }
+        block(0);
+        group.Wait();
+      } else {
+        for (size_t ic = 0; ic < m; ic += MC) {
+          block(ic);
+        }
+      }
+    }
+  }
+}
+
+} // namespace thrd
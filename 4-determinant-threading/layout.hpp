@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cstddef>
+
+
+namespace thrd {
+
+/*
+  Storage order of a Matrix. A layout tells where element (i, j) of an n x n
+  matrix lives, how many elements the storage needs and the order to walk it
+  sequentially. Strided layouts also give their row and column strides, so
+  views and Gemm can work on them directly.
+*/
+template<typename T, typename Layout>
+class LayoutRow
+{
+public:
+  LayoutRow(T* data, const size_t i, const size_t n) : _data(data), _i(i), _n(n) {};
+
+  T& operator[](const size_t j) const { return _data[Layout::Index(_i, j, _n)]; };
+
+private:
+  T* _data;
+  size_t _i;
+  size_t _n;
+};
+
+
+struct RowMajor
+{
+  static const bool strided = true;
+
+  template<typename T>
+  using row_t = T*;
+
+  static size_t Capacity(const size_t n) { return n * n; };
+  static size_t Index(const size_t i, const size_t j, const size_t n) { return i * n + j; };
+  static size_t RowStride(const size_t n) { return n; };
+  static size_t ColStride(const size_t) { return 1; };
+
+  template<typename T>
+  static T* Row(T* data, const size_t i, const size_t n) { return data + i * n; };
+
+  template<typename F>
+  static void Traverse(const size_t n, F f)
+  {
+    for (size_t i = 0, k = 0; i < n; ++i) {
+      for (size_t j = 0; j < n; ++j, ++k) f(i, j, k);
+    }
+  };
+};
+
+
+struct ColumnMajor
+{
+  static const bool strided = true;
+
+  template<typename T>
+  using row_t = LayoutRow<T, ColumnMajor>;
+
+  static size_t Capacity(const size_t n) { return n * n; };
+  static size_t Index(const size_t i, const size_t j, const size_t n) { return i + j * n; };
+  static size_t RowStride(const size_t) { return 1; };
+  static size_t ColStride(const size_t n) { return n; };
+
+  template<typename T>
+  static row_t<T> Row(T* data, const size_t i, const size_t n) { return row_t<T>(data, i, n); };
+
+  template<typename F>
+  static void Traverse(const size_t n, F f)
+  {
+    for (size_t j = 0, k = 0; j < n; ++j) {
+      for (size_t i = 0; i < n; ++i, ++k) f(i, j, k);
+    }
+  };
+};
+
+
+/*
+  B x B row-major tiles in Morton (Z) order, so tiles close in the matrix are
+  close in memory at every scale. The tile grid is padded to a power of two.
+*/
+template<size_t B = 32>
+struct Morton
+{
+  static const bool strided = false;
+
+  template<typename T>
+  using row_t = LayoutRow<T, Morton>;
+
+  static size_t Tiles(const size_t n)
+  {
+    size_t tiles = 1;
+    while (tiles * B < n) tiles <<= 1;
+    return tiles;
+  };
+
+  static size_t Capacity(const size_t n) { return n == 0 ? 0 : Tiles(n) * Tiles(n) * B * B; };
+  static size_t Index(const size_t i, const size_t j, const size_t) { return (Interleave(i / B, j / B) * B + i % B) * B + j % B; };
+  static size_t RowStride(const size_t) { return 0; };
+  static size_t ColStride(const size_t) { return 0; };
+
+  template<typename T>
+  static row_t<T> Row(T* data, const size_t i, const size_t n) { return row_t<T>(data, i, n); };
+
+  // tiles in Morton order, skipping the padding ones, rows inside a tile
+  template<typename F>
+  static void Traverse(const size_t n, F f)
+  {
+    const auto tiles = n == 0 ? 0 : Tiles(n) * Tiles(n);
+    for (size_t t = 0; t < tiles; ++t) {
+      size_t ti, tj;
+      Deinterleave(t, ti, tj);
+      ti *= B;
+      tj *= B;
+      if (ti >= n || tj >= n) continue;
+      for (size_t i = ti; i < ti + B && i < n; ++i) {
+        auto k = Index(i, tj, n);
+        for (size_t j = tj; j < tj + B && j < n; ++j, ++k) f(i, j, k);
+      }
+    }
+  };
+
+  // bits of the tile row go to odd positions, of the tile column to even ones
+  static size_t Interleave(size_t row, size_t col)
+  {
+    size_t index = 0;
+    for (size_t bit = 0; (row | col) != 0; ++bit, row >>= 1, col >>= 1) {
+      index |= ((col & 1) << (2 * bit)) | ((row & 1) << (2 * bit + 1));
+    }
+    return index;
+  };
+
+  static void Deinterleave(size_t index, size_t& row, size_t& col)
+  {
+    row = col = 0;
+    for (size_t bit = 0; index != 0; ++bit, index >>= 2) {
+      col |= (index & 1) << bit;
+      row |= ((index >> 1) & 1) << bit;
+    }
+  };
+};
+
+} // namespace thrd
@@ -10,6 +10,17 @@ using namespace sample;
 
 int main(int argc, char const *argv[])
 {
+  if (argc > 1 && string(argv[1]) == "--calibrate") {
+    auto tuning = Tuning::Calibrate();
+    tuning.Save(Tuning::Path());
+    cout << "laplaceMax: " << tuning.laplaceMax << endl;
+    cout << "serialMax: " << tuning.serialMax << endl;
+    cout << "rowsPerThread: " << tuning.rowsPerThread << endl;
+    cout << "tiledMin: " << tuning.tiledMin << endl;
+    cout << "Saved to " << Tuning::Path() << endl;
+    return 0;
+  }
+
   value_t det = 1;
   
   // auto M = Case<value_t>(TriangleMatrix(10, 2), 0);
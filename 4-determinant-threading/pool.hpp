@@ -0,0 +1,397 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+
+namespace thrd {
+
+class ThreadPool
+{
+public:
+  using task_t = typename std::function<void()>;
+
+  /*
+    Makes pool the one Sized() returns on this thread until the scope ends,
+    so a caller that owns the threads of a call decides where it runs.
+  */
+  class Scope
+  {
+  public:
+    Scope(ThreadPool&);
+    virtual ~Scope();
+
+  private:
+    ThreadPool* _previous;
+  };
+
+  // workers of a bound pool run their tasks in a Scope of it
+  ThreadPool(const size_t count, const bool bound = true);
+  virtual ~ThreadPool();
+
+  static ThreadPool& Shared();
+  // for calls limited to count threads: count - 1 workers and the thread that
+  // waits, or the pool of the enclosing Scope
+  static ThreadPool& Sized(const size_t count);
+
+  void Submit(task_t);
+  bool RunPending();
+
+  const size_t size() const { return _workers.size(); };
+
+private:
+  static ThreadPool*& Current();
+  void Work();
+
+  std::deque<task_t> _tasks;
+  std::vector< std::thread > _workers;
+  std::condition_variable _cv;
+  std::mutex _mtx;
+  bool _stop;
+  bool _bound;
+};
+
+
+/*
+  Fork/join on top of a pool. Wait() runs queued tasks while it is waiting,
+  so groups can be nested inside pool tasks without starving the workers.
+*/
+class TaskGroup
+{
+public:
+  TaskGroup(ThreadPool& = ThreadPool::Shared());
+  virtual ~TaskGroup();
+
+  void Run(ThreadPool::task_t);
+  void Wait();
+
+private:
+  void Done(std::exception_ptr);
+
+  ThreadPool& _pool;
+  std::condition_variable _cv;
+  std::mutex _mtx;
+  size_t _pending;
+  std::exception_ptr _error;
+};
+
+
+/*
+  Dependency graph of tasks. Run() starts every task as soon as the last task
+  it depends on is finished, there are no phases or barriers in between.
+*/
+class TaskGraph
+{
+public:
+  TaskGraph(ThreadPool& = ThreadPool::Shared());
+  virtual ~TaskGraph() = default;
+
+  size_t Add(ThreadPool::task_t);
+  void Depend(const size_t, const size_t);
+
+  void Run();
+  void RunInline();
+
+  const size_t size() const { return _nodes.size(); };
+
+private:
+  struct Node
+  {
+    ThreadPool::task_t task;
+    std::vector<size_t> next;
+    size_t count = 0;
+    std::atomic<size_t> deps;
+  };
+
+  void Start(const size_t, TaskGroup&);
+
+  ThreadPool& _pool;
+  std::vector< std::unique_ptr<Node> > _nodes;
+};
+
+
+/*
+  Threads kept for work that needs all of them running at once, like the
+  barrier-synchronised LU. Run(count, f) calls f(i) for every i < count, f(0)
+  on the caller, and returns when all of them are done. The threads start on
+  the first Run that needs them and are parked in between, so steady calls
+  neither create threads nor allocate. f must not throw.
+*/
+class Crew
+{
+public:
+  Crew() = default;
+  virtual ~Crew();
+
+  template<typename F>
+  void Run(const size_t, F&);
+
+  const size_t size() const { return _threads.size() + 1; };
+
+private:
+  void Work(const size_t, size_t);
+
+  std::vector< std::thread > _threads;
+  std::condition_variable _start, _done;
+  std::mutex _mtx;
+  void (*_call)(void*, size_t) = nullptr;
+  void* _context = nullptr;
+  size_t _count = 0;
+  size_t _generation = 0;
+  size_t _pending = 0;
+  bool _stop = false;
+};
+
+
+ThreadPool::ThreadPool(const size_t count, const bool bound) : _stop(false), _bound(bound)
+{
+  for (size_t i = 0; i < std::max(count, static_cast<size_t>(1)); ++i) {
+    _workers.emplace_back(&ThreadPool::Work, this);
+  }
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(_mtx);
+    _stop = true;
+  }
+  _cv.notify_all();
+  for (auto& worker : _workers) {
+    worker.join();
+  }
+}
+
+ThreadPool& ThreadPool::Shared()
+{
+  static ThreadPool pool(std::thread::hardware_concurrency(), false);
+  return pool;
+}
+
+ThreadPool*& ThreadPool::Current()
+{
+  thread_local ThreadPool* current = nullptr;
+  return current;
+}
+
+ThreadPool::Scope::Scope(ThreadPool& pool) : _previous(Current())
+{
+  Current() = &pool;
+}
+
+ThreadPool::Scope::~Scope()
+{
+  Current() = _previous;
+}
+
+ThreadPool& ThreadPool::Sized(const size_t count)
+{
+  if (Current()) return *Current();
+
+  auto workers = std::max(count, static_cast<size_t>(2)) - 1;
+  auto& shared = Shared();
+  if (workers >= shared.size()) return shared;
+
+  static std::mutex mtx;
+  static std::map< size_t, std::unique_ptr<ThreadPool> > pools;
+  std::lock_guard<std::mutex> lock(mtx);
+  auto& pool = pools[workers];
+  if (!pool) pool.reset(new ThreadPool(workers));
+  return *pool;
+}
+
+void ThreadPool::Submit(task_t task)
+{
+  {
+    std::lock_guard<std::mutex> lock(_mtx);
+    _tasks.push_back(std::move(task));
+  }
+  _cv.notify_one();
+}
+
+bool ThreadPool::RunPending()
+{
+  std::unique_lock<std::mutex> lock(_mtx);
+  if (_tasks.empty()) return false;
+
+  auto task = std::move(_tasks.front());
+  _tasks.pop_front();
+  lock.unlock();
+  task();
+  return true;
+}
+
+void ThreadPool::Work()
+{
+  if (_bound) Current() = this;
+  while (true) {
+    std::unique_lock<std::mutex> lock(_mtx);
+    _cv.wait(lock, [&]() { return _stop || !_tasks.empty(); });
+    if (_tasks.empty()) return;
+
+    auto task = std::move(_tasks.front());
+    _tasks.pop_front();
+    lock.unlock();
+    task();
+  }
+}
+
+TaskGroup::TaskGroup(ThreadPool& pool) : _pool(pool), _pending(0) {};
+
+TaskGroup::~TaskGroup()
+{
+  std::unique_lock<std::mutex> lock(_mtx);
+  _cv.wait(lock, [&]() { return _pending == 0; });
+}
+
+void TaskGroup::Run(ThreadPool::task_t task)
+{
+  {
+    std::lock_guard<std::mutex> lock(_mtx);
+    ++_pending;
+  }
+  _pool.Submit([this, task]() {
+    std::exception_ptr error;
+    try {
+      task();
+    } catch (...) {
+      error = std::current_exception();
+    }
+    Done(error);
+  });
+}
+
+void TaskGroup::Done(std::exception_ptr error)
+{
+  std::lock_guard<std::mutex> lock(_mtx);
+  if (error && !_error) _error = error;
+  if (--_pending == 0) _cv.notify_all();
+}
+
+void TaskGroup::Wait()
+{
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(_mtx);
+      if (_pending == 0) break;
+    }
+    if (_pool.RunPending()) continue;
+
+    std::unique_lock<std::mutex> lock(_mtx);
+    _cv.wait_for(lock, std::chrono::microseconds(100), [&]() { return _pending == 0; });
+  }
+
+  std::exception_ptr error;
+  std::swap(error, _error);
+  if (error) std::rethrow_exception(error);
+}
+
+TaskGraph::TaskGraph(ThreadPool& pool) : _pool(pool) {};
+
+size_t TaskGraph::Add(ThreadPool::task_t task)
+{
+  _nodes.emplace_back(new Node());
+  _nodes.back()->task = std::move(task);
+  return _nodes.size() - 1;
+}
+
+// task waits for on
+void TaskGraph::Depend(const size_t task, const size_t on)
+{
+  _nodes[on]->next.push_back(task);
+  ++_nodes[task]->count;
+}
+
+void TaskGraph::Run()
+{
+  TaskGroup group(_pool);
+  for (auto& node : _nodes) {
+    node->deps = node->count;
+  }
+  for (size_t i = 0; i < _nodes.size(); ++i) {
+    if (_nodes[i]->count == 0) Start(i, group);
+  }
+  group.Wait();
+}
+
+// tasks must have been added in a topological order
+void TaskGraph::RunInline()
+{
+  for (auto& node : _nodes) {
+    node->task();
+  }
+}
+
+void TaskGraph::Start(const size_t i, TaskGroup& group)
+{
+  group.Run([this, i, &group]() {
+    auto& node = *_nodes[i];
+    node.task();
+    for (auto next : node.next) {
+      if (--_nodes[next]->deps == 0) Start(next, group);
+    }
+  });
+}
+
+Crew::~Crew()
+{
+  {
+    std::lock_guard<std::mutex> lock(_mtx);
+    _stop = true;
+  }
+  _start.notify_all();
+  for (auto& thread : _threads) {
+    thread.join();
+  }
+}
+
+template<typename F>
+void Crew::Run(const size_t count, F& f)
+{
+  {
+    std::lock_guard<std::mutex> lock(_mtx);
+    while (_threads.size() + 1 < count) {
+      _threads.emplace_back(&Crew::Work, this, _threads.size() + 1, _generation);
+    }
+    _call = [](void* context, size_t i) { (*static_cast<F*>(context))(i); };
+    _context = &f;
+    _count = count;
+    _pending = count > 0 ? count - 1 : 0;
+    ++_generation;
+  }
+  _start.notify_all();
+
+  if (count > 0) f(0);
+  std::unique_lock<std::mutex> lock(_mtx);
+  _done.wait(lock, [&]() { return _pending == 0; });
+}
+
+// threads past the count of a run only take note of it
+void Crew::Work(const size_t index, size_t seen)
+{
+  std::unique_lock<std::mutex> lock(_mtx);
+  while (true) {
+    _start.wait(lock, [&]() { return _stop || _generation != seen; });
+    if (_stop) return;
+    seen = _generation;
+    if (index >= _count) continue;
+
+    auto call = _call;
+    auto context = _context;
+    lock.unlock();
+    call(context, index);
+    lock.lock();
+    if (--_pending == 0) _done.notify_one();
+  }
+}
+
+} // namespace thrd
@@ -1,8 +1,10 @@
 #pragma once
 
 #include <cmath>
+#include <cstdint>
 #include <vector>
-#include <stdlib.h>
+#include <utility>
+#include <algorithm>
 #include <initializer_list>
 
 #include "determinant.hpp"
@@ -45,14 +47,151 @@ namespace sample {
     return M;
   }
 
-  thrd::Matrix<value_t> RandomMatrix(size_t n)
+  const uint64_t SEED = 0x5eed;
+
+  /*
+    Counter based generator (SplitMix64 as a hash): the k-th number of a
+    stream only depends on the seed and k, so elements can be generated in
+    any order, on any number of threads, and always come out the same.
+  */
+  class Random
   {
-    srand( time(0) );
-    thrd::Matrix<value_t> M(n);
-    for (size_t i = 0; i < n; ++i)
-      for (size_t j = 0; j < n; ++j)
-        M[i][j] = rand() % 10;
-    return M;
+  public:
+    explicit Random(const uint64_t seed = SEED) : _key(Mix(seed)) {};
+
+    uint64_t Bits(const uint64_t k) const { return Mix(_key + (k + 1) * 0x9e3779b97f4a7c15ULL); };
+
+    // [0, 1) from the top 53 bits
+    double Uniform(const uint64_t k) const { return (Bits(k) >> 11) * (1.0 / 9007199254740992.0); };
+
+    // Box-Muller, uses the numbers 2k and 2k + 1
+    double Normal(const uint64_t k) const
+    {
+      auto u = 1.0 - Uniform(2 * k);
+      return std::sqrt(-2.0 * std::log(u)) * std::cos(2 * M_PI * Uniform(2 * k + 1));
+    };
+
+    // an independent stream, for the parts of a generator
+    Random Stream(const uint64_t stream) const { return Random(_key ^ Mix(stream + 1)); };
+
+  private:
+    static uint64_t Mix(uint64_t z)
+    {
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+      return z ^ (z >> 31);
+    };
+
+    uint64_t _key;
+  };
+
+
+  // elements from f(i, j), filled in parallel like any other expression
+  template<typename T, typename F>
+  class Generated : public thrd::Expression< Generated<T, F> >
+  {
+  public:
+    using value_type = T;
+
+    Generated(const size_t n, F f) : _n(n), _f(f) {};
+
+    const size_t size() const { return _n; };
+    value_type operator()(const size_t i, const size_t j) const { return _f(i, j); };
+
+  private:
+    size_t _n;
+    F _f;
+  };
+
+  template<typename T, typename F>
+  thrd::Matrix<T> Generate(const size_t n, F f)
+  {
+    return thrd::Matrix<T>(Generated<T, F>(n, f));
+  }
+
+
+  thrd::Matrix<value_t> RandomMatrix(size_t n, uint64_t seed = SEED)
+  {
+    Random rng(seed);
+    return Generate<value_t>(n, [=](size_t i, size_t j) { return static_cast<value_t>(rng.Bits(i * n + j) % 10); });
+  }
+
+  thrd::Matrix<double> UniformMatrix(size_t n, uint64_t seed = SEED, double lo = -1, double hi = 1)
+  {
+    Random rng(seed);
+    return Generate<double>(n, [=](size_t i, size_t j) { return lo + (hi - lo) * rng.Uniform(i * n + j); });
+  }
+
+  thrd::Matrix<double> NormalMatrix(size_t n, uint64_t seed = SEED, double mean = 0, double sd = 1)
+  {
+    Random rng(seed);
+    return Generate<double>(n, [=](size_t i, size_t j) { return mean + sd * rng.Normal(i * n + j); });
+  }
+
+  /*
+    U * diag(s) * V with singular values s from 1 down to 1 / cond, evenly on
+    a log scale, and U, V random Householder reflections, so the 2-norm
+    condition number is exactly cond and the determinant is the product of s,
+    cond^(-n/2). O(n^2), every element is a closed form of a few vectors.
+  */
+  thrd::Matrix<double> ConditionedMatrix(size_t n, double cond, uint64_t seed = SEED)
+  {
+    Random ru(Random(seed).Stream(0)), rv(Random(seed).Stream(1));
+    std::vector<double> s(n), u(n), v(n);
+    double nu = 0, nv = 0;
+    for (size_t i = 0; i < n; ++i) {
+      s[i] = n > 1 ? std::pow(cond, -static_cast<double>(i) / (n - 1)) : 1;
+      u[i] = ru.Normal(i);
+      v[i] = rv.Normal(i);
+      nu += u[i] * u[i];
+      nv += v[i] * v[i];
+    }
+    double c = 0;
+    for (size_t i = 0; i < n; ++i) {
+      u[i] /= std::sqrt(nu);
+      v[i] /= std::sqrt(nv);
+      c += u[i] * s[i] * v[i];
+    }
+
+    // (I - 2uu') diag(s) (I - 2vv') = X - 2u w' with X = diag(s) - 2 (s.v) v' and w' = u'X
+    return Generate<double>(n, [=](size_t i, size_t j) {
+      double x = (i == j ? s[i] : 0) - 2 * s[i] * v[i] * v[j];
+      double w = s[j] * u[j] - 2 * c * v[j];
+      return x - 2 * u[i] * w;
+    });
+  }
+
+  // each element is nonzero with probability density, nonzeros are normal
+  thrd::Matrix<double> SparseMatrix(size_t n, double density, uint64_t seed = SEED)
+  {
+    Random pick(Random(seed).Stream(0)), value(Random(seed).Stream(1));
+    return Generate<double>(n, [=](size_t i, size_t j) {
+      return pick.Uniform(i * n + j) < density ? value.Normal(i * n + j) : 0.0;
+    });
+  }
+
+  // normal inside the band, lower diagonals below the main one and upper above it
+  thrd::Matrix<double> BandedMatrix(size_t n, size_t lower, size_t upper, uint64_t seed = SEED)
+  {
+    Random rng(seed);
+    return Generate<double>(n, [=](size_t i, size_t j) {
+      return (j + lower >= i && j <= i + upper) ? rng.Normal(i * n + j) : 0.0;
+    });
+  }
+
+  // symmetric and strictly diagonally dominant with a positive diagonal, so positive definite
+  thrd::Matrix<double> SpdMatrix(size_t n, uint64_t seed = SEED)
+  {
+    Random rng(seed);
+    auto offDiagonal = [=](size_t i, size_t j) { return 2 * rng.Uniform(std::min(i, j) * n + std::max(i, j)) - 1; };
+    return Generate<double>(n, [=](size_t i, size_t j) {
+      if (i != j) return offDiagonal(i, j);
+      double sum = 1;
+      for (size_t k = 0; k < n; ++k) {
+        if (k != i) sum += std::fabs(offDiagonal(i, k));
+      }
+      return sum;
+    });
   }
 
   thrd::Matrix<value_t> DiagonalMatrix(size_t n, value_t val)
@@ -63,23 +202,18 @@ namespace sample {
     return M;
   }
 
-  thrd::Matrix<value_t> TriangleMatrix(size_t n, value_t val)
+  thrd::Matrix<value_t> TriangleMatrix(size_t n, value_t val, uint64_t seed = SEED)
   {
-    srand( time(0) );
-    thrd::Matrix<value_t> M(n, 0);
-    for (size_t i = 0; i < n; ++i) {
-      M[i][i] = val;
-      for (size_t j = i + 1; j < n; ++j) {
-        M[i][j] = rand() % 10;
-      }
-    }
-    return M;
+    Random rng(seed);
+    return Generate<value_t>(n, [=](size_t i, size_t j) {
+      return i == j ? val : i < j ? static_cast<value_t>(rng.Bits(i * n + j) % 10) : 0;
+    });
   }
 
   template<typename T>
   struct Case
   {
-    Case(thrd::Matrix<T> m, T val) : matrix(m), expectedDet(val) {};
+    Case(thrd::Matrix<T> m, T val) : matrix(std::move(m)), expectedDet(val) {};
     Case(std::initializer_list< std::initializer_list<T> > m, T val) : matrix(m), expectedDet(val) {};
     virtual ~Case() = default;
 
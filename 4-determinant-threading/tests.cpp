@@ -1,4 +1,8 @@
+#include <atomic>
 #include <cmath>
+#include <chrono>
+#include <cstdlib>
+#include <new>
 #include <thread>
 
 // #include <iostream>
@@ -6,11 +10,25 @@
 
 #include "catch.hpp"
 #include "determinant.hpp"
+#include "batch.hpp"
 #include "samples.hpp"
 
 const int THREADS_COUNT = std::thread::hardware_concurrency();
 const long double EPS = 1e-13;
 
+// every heap allocation of the test binary, on any thread
+std::atomic<size_t> heapAllocations(0);
+
+__attribute__((noinline)) void* operator new(size_t size)
+{
+  ++heapAllocations;
+  if (void* p = std::malloc(size ? size : 1)) return p;
+  throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept { std::free(p); }
+
 TEST_CASE("Predefined samples") {
 
   SECTION("CHECK for A no threading") {
@@ -132,3 +150,774 @@ TEST_CASE("Advanced tests") {
   }
 
 }
+
+TEST_CASE("Scratch arena") {
+
+  SECTION("CHECK steady-state calls don't grow the arena") {
+    auto M = sample::RandomMatrix(20);
+    auto L = sample::RandomMatrix(8);
+    auto det = M.DeterminantLU(THREADS_COUNT);
+    auto detL = L.DeterminantLaplace(THREADS_COUNT);
+    auto stats = thrd::Arena::Local().GetStats();
+    REQUIRE(stats.allocations > 0);
+
+    REQUIRE(M.DeterminantLU(THREADS_COUNT) == det);
+    REQUIRE(L.DeterminantLaplace(THREADS_COUNT) == detL);
+    REQUIRE(thrd::Arena::Local().GetStats().allocations == stats.allocations);
+    REQUIRE(thrd::Arena::Local().GetStats().bytes == stats.bytes);
+    REQUIRE(thrd::Arena::Local().GetStats().requests > stats.requests);
+  }
+
+  SECTION("CHECK steady-state calls don't touch the heap") {
+    auto M = sample::RandomMatrix(40);
+    auto L = sample::RandomMatrix(8);
+    size_t allocations = 0;
+    for (auto pass = 0; pass < 3; ++pass) {
+      auto before = heapAllocations.load();
+      M.DeterminantLU(4);
+      M.DeterminantLU(1);
+      L.DeterminantLaplace(4);
+      M.DeterminantCertified();
+      allocations = heapAllocations - before;
+    }
+    REQUIRE(allocations == 0);
+  }
+
+  SECTION("CHECK smaller matrices reuse grown buffers") {
+    thrd::Arena::Local().Release();
+    for (auto i = 2; i < 40; ++i) {
+      thrd::Matrix<sample::value_t>(i, 1).DeterminantLU();
+    }
+    auto stats = thrd::Arena::Local().GetStats();
+    for (auto i = 2; i < 40; ++i) {
+      thrd::Matrix<sample::value_t>(i, 1).DeterminantLU();
+    }
+    REQUIRE(thrd::Arena::Local().GetStats().allocations == stats.allocations);
+  }
+
+}
+
+TEST_CASE("Recursive LU") {
+
+  SECTION("CHECK predefined samples") {
+    REQUIRE( std::fabs(sample::A.matrix.DeterminantRLU() - sample::A.expectedDet) < 1e-9 );
+    REQUIRE( std::fabs(sample::B.matrix.DeterminantRLU(THREADS_COUNT) - sample::B.expectedDet) < 1e-9 );
+    REQUIRE( std::fabs(sample::H.matrix.Determinant(THREADS_COUNT, sample::H.matrix.RLU) - sample::H.expectedDet) < 1e-9 );
+    REQUIRE( std::fabs(sample::Hilb8.matrix.DeterminantRLU() - sample::Hilb8.expectedDet) < 1e-33 );
+  }
+
+  SECTION("CHECK RLU == LU for large matrices") {
+    for (auto n : { 1, 2, 3, 31, 64, 100, 157 }) {
+      auto M = sample::RandomMatrix(n);
+      auto det = M.DeterminantLU();
+      REQUIRE( std::fabs(M.DeterminantRLU() - det) <= 1e-9 * std::fabs(det) );
+      REQUIRE( std::fabs(M.DeterminantRLU(4) - det) <= 1e-9 * std::fabs(det) );
+    }
+    REQUIRE( sample::TriangleMatrix(70, 2).DeterminantRLU(4) == std::pow(2.0L, 70) );
+    REQUIRE( thrd::Matrix<sample::value_t>(50, 3).DeterminantRLU(4) == 0 );
+  }
+
+}
+
+TEST_CASE("Tiled LU") {
+
+  SECTION("CHECK predefined samples") {
+    REQUIRE( std::fabs(sample::A.matrix.DeterminantTiled(1, 2) - sample::A.expectedDet) < 1e-9 );
+    REQUIRE( std::fabs(sample::B.matrix.DeterminantTiled(THREADS_COUNT, 2) - sample::B.expectedDet) < 1e-9 );
+    REQUIRE( std::fabs(sample::H.matrix.Determinant(THREADS_COUNT, sample::H.matrix.TILED) - sample::H.expectedDet) < 1e-9 );
+    REQUIRE( std::fabs(sample::Hilb8.matrix.DeterminantTiled(4, 3) - sample::Hilb8.expectedDet) < 1e-33 );
+  }
+
+  SECTION("CHECK TILED == LU for any tile size") {
+    for (auto n : { 1, 2, 17, 64, 130 }) {
+      auto M = sample::RandomMatrix(n);
+      auto det = M.DeterminantLU();
+      for (auto tile : { 1, 5, 16, 64, 200 }) {
+        REQUIRE( std::fabs(M.DeterminantTiled(1, tile) - det) <= 1e-9 * std::fabs(det) );
+        REQUIRE( std::fabs(M.DeterminantTiled(4, tile) - det) <= 1e-9 * std::fabs(det) );
+      }
+    }
+    REQUIRE( thrd::Matrix<sample::value_t>(50, 3).DeterminantTiled(4, 8) == 0 );
+  }
+
+  SECTION("CHECK tasks run on at most threadsCount threads") {
+    for (size_t count : { 1, 2, 3, 64 }) {
+      auto& pool = thrd::ThreadPool::Sized(count);
+      REQUIRE( pool.size() <= std::max(count, static_cast<size_t>(2)) - 1 );
+      REQUIRE( &pool == &thrd::ThreadPool::Sized(count) );
+    }
+    REQUIRE( thrd::ThreadPool::Sized(2).size() == 1 );
+
+    // a scope decides the pool, its workers stay in it
+    thrd::ThreadPool pool(3);
+    {
+      thrd::ThreadPool::Scope scope(pool);
+      REQUIRE( &thrd::ThreadPool::Sized(2) == &pool );
+      thrd::ThreadPool* nested = nullptr;
+      thrd::TaskGroup group(pool);
+      group.Run([&]() { nested = &thrd::ThreadPool::Sized(8); });
+      group.Wait();
+      REQUIRE( nested == &pool );
+    }
+    REQUIRE( &thrd::ThreadPool::Sized(2) != &pool );
+  }
+
+}
+
+TEST_CASE("Tournament pivoting") {
+
+  SECTION("CHECK LU result doesn't depend on the threads count") {
+    auto M = sample::RandomMatrix(120);
+    auto det = M.DeterminantLU();
+    for (auto threads : { 2, 3, 4, 7, 8 }) {
+      REQUIRE(M.DeterminantLU(threads) == det);
+    }
+  }
+
+  SECTION("CHECK tree reduction picks the largest value and the lowest row on ties") {
+    thrd::Arena arena;
+    auto& t = arena.Pivots(5);
+    t.Offer(3, 2, 30);
+    t.Offer(0, 1, 0);
+    t.Offer(4, 7, 40);
+    t.Offer(2, 7, 20);
+    t.Offer(1, -1, 100);
+    REQUIRE(t.Winner() == 20);
+  }
+
+}
+
+TEST_CASE("Distributed LU") {
+
+  SECTION("CHECK block-cyclic layout") {
+    thrd::BlockCyclic layout(10, 6, 2);
+    REQUIRE(layout.Rows() == 2);
+    REQUIRE(layout.Cols() == 3);
+    REQUIRE(layout.Count(0, layout.Cols()) + layout.Count(1, layout.Cols()) + layout.Count(2, layout.Cols()) == 10);
+    for (size_t i = 0; i < 10; ++i) {
+      auto owner = layout.Owner(i, layout.Cols());
+      REQUIRE(layout.Global(layout.Local(i, layout.Cols()), owner, layout.Cols()) == i);
+    }
+  }
+
+  SECTION("CHECK predefined samples") {
+    REQUIRE( std::fabs(sample::A.matrix.DeterminantDistributed(4, 1) - sample::A.expectedDet) < 1e-9 );
+    REQUIRE( std::fabs(sample::B.matrix.DeterminantDistributed(3, 2) - sample::B.expectedDet) < 1e-9 );
+    REQUIRE( std::fabs(sample::H.matrix.Determinant(2, sample::H.matrix.DISTRIBUTED) - sample::H.expectedDet) < 1e-9 );
+    REQUIRE( thrd::Matrix<sample::value_t>(20, 3).DeterminantDistributed(4, 3) == 0 );
+  }
+
+  SECTION("CHECK DISTRIBUTED == LU") {
+    auto M = sample::RandomMatrix(45);
+    auto det = M.DeterminantLU();
+    for (auto processes : { 1, 2, 4, 6 }) {
+      REQUIRE( std::fabs(M.DeterminantDistributed(processes, 4) - det) <= 1e-9 * std::fabs(det) );
+    }
+  }
+
+}
+
+TEST_CASE("Adaptive dispatcher") {
+
+  SECTION("CHECK AUTO on predefined samples") {
+    REQUIRE( std::fabs(sample::A.matrix.Determinant(THREADS_COUNT, sample::A.matrix.AUTO) - sample::A.expectedDet) < 1e-9 );
+    REQUIRE( std::fabs(sample::B.matrix.DeterminantAuto() - sample::B.expectedDet) < 1e-9 );
+    REQUIRE( std::fabs(sample::Hilb8.matrix.DeterminantAuto() - sample::Hilb8.expectedDet) < 1e-33 );
+    REQUIRE( thrd::Matrix<sample::value_t>({ { 2, 1 }, { 3, 4 } }).DeterminantAuto() == 5 );
+  }
+
+  SECTION("CHECK AUTO == LU for large matrices") {
+    auto M = sample::RandomMatrix(200);
+    auto det = M.DeterminantLU();
+    REQUIRE( std::fabs(M.DeterminantAuto(THREADS_COUNT) - det) <= 1e-9 * std::fabs(det) );
+  }
+
+  SECTION("CHECK triangular structure is detected") {
+    REQUIRE(sample::TriangleMatrix(300, 2).IsTriangular());
+    REQUIRE(sample::DiagonalMatrix(10, 2).IsTriangular());
+    REQUIRE_FALSE(sample::A.matrix.IsTriangular());
+    auto M = sample::TriangleMatrix(50, 2);
+    thrd::Matrix<sample::value_t> L(50);
+    for (size_t i = 0; i < 50; ++i) {
+      for (size_t j = 0; j < 50; ++j) L[i][j] = M[j][i];
+    }
+    REQUIRE(L.IsTriangular());
+    M[49][0] = 1;
+    REQUIRE_FALSE(M.IsTriangular());
+    REQUIRE(sample::TriangleMatrix(300, 2).DeterminantAuto() == std::pow(2.0L, 300));
+  }
+
+  SECTION("CHECK tuning survives save and load") {
+    thrd::Tuning tuning;
+    tuning.laplaceMax = 6;
+    tuning.serialMax = 99;
+    tuning.rowsPerThread = 33;
+    tuning.tiledMin = 512;
+    REQUIRE(tuning.Save("tuning_test.txt"));
+
+    thrd::Tuning loaded;
+    REQUIRE(loaded.Load("tuning_test.txt"));
+    REQUIRE(loaded.laplaceMax == 6);
+    REQUIRE(loaded.serialMax == 99);
+    REQUIRE(loaded.rowsPerThread == 33);
+    REQUIRE(loaded.tiledMin == 512);
+    std::remove("tuning_test.txt");
+    REQUIRE_FALSE(loaded.Load("tuning_test.txt"));
+  }
+
+}
+
+TEST_CASE("Determinant stats") {
+
+  SECTION("CHECK stats overload returns the same determinant") {
+    auto M = sample::RandomMatrix(60);
+    thrd::DetStats stats;
+    REQUIRE(M.Determinant(THREADS_COUNT, M.LU, stats) == M.DeterminantLU(THREADS_COUNT));
+    REQUIRE( std::fabs(sample::B.matrix.Determinant(1, sample::B.matrix.RLU, stats) - sample::B.expectedDet) < 1e-9 );
+
+#ifdef THRD_STATS
+    M.Determinant(4, M.LU, stats);
+    REQUIRE(stats.threads.size() == 4);
+    REQUIRE(stats.total > 0);
+    size_t rows = 0;
+    for (const auto& thread : stats.threads) {
+      rows += thread.rows;
+    }
+    REQUIRE(rows == 60 * 59 / 2);
+    REQUIRE(stats.flops > 2 * 60 * 60 * 60 / 3 - 2 * 60 * 60);
+    REQUIRE(stats.bytes > 0);
+    REQUIRE(stats.valid);
+
+    // the thread's arena is taken, the call allocates in a private one
+    thrd::Arena::Lease outer;
+    M.Determinant(1, M.RLU, stats);
+    REQUIRE(stats.allocations > 0);
+#else
+    REQUIRE_FALSE(stats.valid);
+    REQUIRE(stats.threads.empty());
+    REQUIRE(stats.total == 0);
+    REQUIRE(stats.flops == 0);
+#endif
+  }
+
+}
+
+TEST_CASE("Async determinant") {
+
+  SECTION("CHECK async result matches the sync one") {
+    auto a = sample::B.matrix.DeterminantAsync();
+    auto b = sample::Hilb8.matrix.DeterminantAsync(THREADS_COUNT, sample::Hilb8.matrix.RLU);
+    auto M = sample::RandomMatrix(80);
+    auto c = M.DeterminantAsync(4, M.TILED);
+    REQUIRE( std::fabs(a.get() - sample::B.expectedDet) < 1e-9 );
+    REQUIRE( std::fabs(b.get() - sample::Hilb8.expectedDet) < 1e-33 );
+    REQUIRE( c.get() == M.DeterminantTiled(4) );
+  }
+
+  SECTION("CHECK cancelled Laplace stops early") {
+    auto start = std::chrono::steady_clock::now();
+    auto M = sample::RandomMatrix(13);
+    auto future = M.DeterminantAsync(2, M.LAPLACE);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    future.Cancel();
+    REQUIRE_THROWS_AS(future.get(), thrd::CancelledError);
+    REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::seconds(10));
+  }
+
+  SECTION("CHECK deadline stops LU between columns") {
+    auto M = sample::RandomMatrix(300);
+    auto future = M.DeterminantAsync(THREADS_COUNT, M.LU, std::chrono::steady_clock::now());
+    REQUIRE_THROWS_AS(future.get(), thrd::CancelledError);
+
+    auto late = M.DeterminantAsync(THREADS_COUNT, M.LU, std::chrono::steady_clock::now() + std::chrono::hours(1));
+    REQUIRE(late.get() == M.DeterminantLU(THREADS_COUNT));
+  }
+
+  // full runs take seconds, a deadline that expires partway must end them
+  // long before, well within a generous multiple of the deadline
+  SECTION("CHECK deadlines stop LU, RLU and TILED partway") {
+    using clock = std::chrono::steady_clock;
+    const auto deadline = std::chrono::milliseconds(20);
+    auto M = sample::RandomMatrix(800);
+    for (auto method : { M.LU, M.RLU, M.TILED }) {
+      auto start = clock::now();
+      auto future = M.DeterminantAsync(THREADS_COUNT, method, start + deadline);
+      REQUIRE_THROWS_AS(future.get(), thrd::CancelledError);
+      REQUIRE(clock::now() - start < 25 * deadline);
+    }
+  }
+
+}
+
+// exact det of Hilbert n: c(n)^4 / c(2n), c(n) = 1! * 2! * ... * (n - 1)!
+long double exactHilbert(size_t n)
+{
+  auto c = [](size_t n) {
+    long double result = 1, factorial = 1;
+    for (size_t i = 1; i < n; ++i) {
+      factorial *= i;
+      result *= factorial;
+    }
+    return result;
+  };
+  return std::pow(c(n), 4) / c(2 * n);
+}
+
+TEST_CASE("Certified mixed precision") {
+
+  SECTION("CHECK well conditioned matrices stay in double") {
+    auto result = sample::B.matrix.DeterminantCertified();
+    REQUIRE_FALSE(result.escalated);
+    REQUIRE(result.relativeError < 1e-10);
+    REQUIRE( std::fabs(result.det - sample::B.expectedDet) <= result.relativeError * std::fabs(result.det) );
+
+    auto M = sample::RandomMatrix(150);
+    auto det = M.DeterminantLU();
+    auto random = M.DeterminantCertified(THREADS_COUNT, 1);
+    REQUIRE( std::fabs(random.det - det) <= random.relativeError * std::fabs(det) );
+  }
+
+  SECTION("CHECK ill conditioned matrices are escalated") {
+    auto result = sample::Hilb8.matrix.DeterminantCertified();
+    REQUIRE(result.escalated);
+    REQUIRE( std::fabs(result.det - exactHilbert(8)) <= result.relativeError * std::fabs(result.det) );
+
+    // the double result itself, its bound must hold however large it is
+    for (size_t n = 3; n <= 10; ++n) {
+      auto single = sample::Hilbert(n).DeterminantCertified(1, 1e30);
+      REQUIRE_FALSE(single.escalated);
+      REQUIRE( std::fabs(single.det - exactHilbert(n)) <= single.relativeError * std::fabs(exactHilbert(n)) );
+    }
+
+    auto H = sample::Hilbert(12);
+    auto hilbert = H.DeterminantCertified(THREADS_COUNT);
+    REQUIRE(hilbert.escalated);
+    REQUIRE( std::fabs(hilbert.det - exactHilbert(12)) <= hilbert.relativeError * std::fabs(hilbert.det) );
+  }
+
+  SECTION("CHECK integer matrices are escalated to exact arithmetic") {
+    auto result = sample::A.matrix.DeterminantCertified(1, 0);
+    REQUIRE(result.escalated);
+    REQUIRE(result.det == sample::A.expectedDet);
+    REQUIRE(result.relativeError == 0);
+
+    auto singular = thrd::Matrix<sample::value_t>(20, 3).DeterminantCertified();
+    REQUIRE(singular.det == 0);
+    REQUIRE(singular.relativeError == 0);
+    REQUIRE(singular.singular);
+  }
+
+  SECTION("CHECK singular matrices are flagged in long double") {
+    auto M = sample::Hilbert(10);
+    for (size_t j = 0; j < 10; ++j) {
+      M[9][j] = M[3][j];
+    }
+    auto result = M.DeterminantCertified(THREADS_COUNT);
+    REQUIRE(result.escalated);
+    REQUIRE(result.singular);
+    REQUIRE(result.det == 0);
+
+    auto regular = sample::Hilbert(10).DeterminantCertified(THREADS_COUNT);
+    REQUIRE_FALSE(regular.singular);
+    REQUIRE(std::isfinite(regular.relativeError));
+  }
+
+}
+
+TEST_CASE("Matrix multiplication") {
+
+  SECTION("CHECK product matches the naive one") {
+    for (auto n : { 1, 3, 7, 70, 130 }) {
+      auto A = sample::RandomMatrix(n);
+      auto B = sample::TriangleMatrix(n, 3);
+      thrd::Matrix<sample::value_t> C = A * B;
+      auto D = A.Multiply(B, 4);
+      thrd::Matrix<sample::value_t> E = thrd::Multiply(A, B, 2);
+      bool equal = true;
+      for (auto i = 0; i < n; ++i) {
+        for (auto j = 0; j < n; ++j) {
+          sample::value_t x = 0;
+          for (auto k = 0; k < n; ++k) {
+            x += A[i][k] * B[k][j];
+          }
+          equal = equal && C[i][j] == x && D[i][j] == x && E[i][j] == x;
+        }
+      }
+      REQUIRE(equal);
+    }
+  }
+
+  SECTION("CHECK det[A * B] == det[A] * det[B]") {
+    auto BC = sample::B.matrix * sample::C.matrix.Multiply(sample::C.matrix);
+    REQUIRE( std::fabs(thrd::DeterminantLU(BC) / (sample::B.expectedDet * 72.0L * 72.0L) - 1) < 1e-15 );
+    REQUIRE_THROWS_AS(sample::A.matrix * sample::C.matrix, std::invalid_argument);
+
+    auto H = sample::Hilbert(6) * sample::Hilbert(6);
+    REQUIRE( std::fabs(thrd::DeterminantLU(H) / (sample::Hilbert(6).DeterminantLU() * sample::Hilbert(6).DeterminantLU()) - 1) < 1e-6 );
+
+    auto M = sample::Hilb8.matrix * thrd::Matrix<long double>(8, 0);
+    REQUIRE(thrd::DeterminantLU(M) == 0);
+  }
+
+  SECTION("CHECK strided GEMM on column-major blocks") {
+    // C (2x2, col-major in a 3x3 buffer) = 2 * A (2x3, row-major) * B (3x2, col-major) + C
+    double a[] = { 1, 2, 3, 4, 5, 6 };
+    double b[] = { 1, 0, 1, 0, 1, 0 };
+    double c[] = { 1, 1, 0, 1, 1, 0, 0, 0, 0 };
+    thrd::Gemm<double>(2, 2, 3, 2, a, 3, 1, b, 1, 3, 1, c, 1, 3);
+    REQUIRE(c[0] == 9);
+    REQUIRE(c[1] == 21);
+    REQUIRE(c[3] == 5);
+    REQUIRE(c[4] == 11);
+    REQUIRE(c[2] == 0);
+  }
+
+  SECTION("CHECK the vector double kernel matches the scalar one") {
+    const size_t kc = 37;
+    std::vector<double> a(4 * kc), b(8 * kc);
+    for (size_t i = 0; i < a.size(); ++i) a[i] = std::sin(i + 1.0);
+    for (size_t i = 0; i < b.size(); ++i) b[i] = std::cos(i + 0.5);
+    for (auto shape : { std::make_pair(4, 8), std::make_pair(3, 5), std::make_pair(1, 1) }) {
+      std::vector<double> vector(4 * 8, 1), scalar(4 * 8, 1);
+      thrd::GemmKernel(kc, a.data(), b.data(), shape.first, shape.second, 2.0, 0.5, vector.data(), 8, 1);
+      thrd::GemmKernel<double>(kc, a.data(), b.data(), shape.first, shape.second, 2.0, 0.5, scalar.data(), 8, 1);
+      REQUIRE(vector == scalar);
+    }
+  }
+
+}
+
+TEST_CASE("Matrix expressions") {
+
+  SECTION("CHECK elementwise chains are evaluated lazily and exactly") {
+    for (auto n : { 1, 5, 90 }) {
+      auto A = sample::RandomMatrix(n);
+      auto B = sample::TriangleMatrix(n, 3);
+      thrd::Matrix<sample::value_t> C = 2 * A - B + A * 3 - (-B);
+      bool equal = true;
+      for (auto i = 0; i < n; ++i) {
+        for (auto j = 0; j < n; ++j) {
+          equal = equal && C[i][j] == 5 * A[i][j];
+        }
+      }
+      REQUIRE(equal);
+    }
+    REQUIRE_THROWS_AS(sample::A.matrix + sample::C.matrix, std::invalid_argument);
+  }
+
+  SECTION("CHECK products materialize once inside expressions") {
+    auto I = sample::DiagonalMatrix(5, 1);
+    auto product = sample::C.matrix * I;
+    REQUIRE(product.Result().use_count() == 1);
+    thrd::Matrix<sample::value_t> D = product + product - sample::C.matrix;
+    REQUIRE(product.Result().use_count() == 1);
+    for (auto i = 0; i < 5; ++i) {
+      for (auto j = 0; j < 5; ++j) {
+        REQUIRE(D[i][j] == sample::C.matrix[i][j]);
+      }
+    }
+  }
+
+  SECTION("CHECK det[A * B + C] straight from the expression") {
+    auto I = sample::DiagonalMatrix(5, 1);
+    REQUIRE(thrd::Determinant(sample::C.matrix * I + I - I) == sample::C.expectedDet);
+    REQUIRE(thrd::Determinant(sample::C.matrix * I + I - I, THREADS_COUNT, thrd::Matrix<sample::value_t>::LAPLACE) == sample::C.expectedDet);
+    REQUIRE(thrd::DeterminantLU(sample::C.matrix + I * 0, THREADS_COUNT) == sample::C.expectedDet);
+    REQUIRE(std::fabs(thrd::Determinant(2 * sample::B.matrix) / (sample::B.expectedDet * 32) - 1) < 1e-9);
+  }
+
+}
+
+TEST_CASE("Matrix views") {
+
+  SECTION("CHECK blocks of a bigger matrix are read in place") {
+    auto M = sample::RandomMatrix(40);
+    auto block = M.View().Block(7, 3, 30, 30);
+    thrd::Matrix<sample::value_t> copy = block;
+    REQUIRE(copy[0][0] == M[7][3]);
+    REQUIRE(copy[29][29] == M[36][32]);
+
+    auto det = copy.DeterminantLU();
+    REQUIRE( std::fabs(thrd::DeterminantLU(block) - det) <= 1e-9 * std::fabs(det) );
+    REQUIRE( std::fabs(thrd::Determinant(block, THREADS_COUNT) - det) <= 1e-9 * std::fabs(det) );
+    REQUIRE( std::fabs(thrd::Determinant(block, THREADS_COUNT, thrd::Matrix<sample::value_t>::TILED) - det) <= 1e-9 * std::fabs(det) );
+    REQUIRE( std::fabs(thrd::Determinant(block, THREADS_COUNT, thrd::Matrix<sample::value_t>::RLU) - det) <= 1e-9 * std::fabs(det) );
+    REQUIRE_THROWS_AS(thrd::Determinant(M.View().Block(0, 0, 3, 4)), std::invalid_argument);
+    REQUIRE_THROWS_AS(M.View().Block(20, 20, 30, 30), std::out_of_range);
+  }
+
+  SECTION("CHECK copies of borrowed matrices own their elements") {
+    auto M = sample::RandomMatrix(30);
+    auto det = M.DeterminantLU();
+    auto borrowed = thrd::Matrix<sample::value_t>::Borrow(M.View());
+    auto copy = borrowed;
+    auto future = borrowed.DeterminantAsync(2, borrowed.RLU);
+    M = thrd::Matrix<sample::value_t>(30, 0);
+    REQUIRE(copy.DeterminantLU() == det);
+    REQUIRE( std::fabs(future.get() - det) <= 1e-9 * std::fabs(det) );
+  }
+
+  SECTION("CHECK cofactor expansion over minor views") {
+    const auto& A = sample::A.matrix;
+    auto view = A.View();
+    long double det = 0;
+    for (size_t j = 0; j < A.size(); ++j) {
+      det += (j % 2 ? -1 : 1) * A[0][j] * thrd::Determinant(view.Minor(0, j), 1, thrd::Matrix<sample::value_t>::LAPLACE);
+    }
+    REQUIRE(det == sample::A.expectedDet);
+
+    auto minor = view.Minor(2, 3).Minor(1, 1);
+    REQUIRE(minor.Rows() == 4);
+    REQUIRE(minor(1, 2) == A[3][4]);
+  }
+
+  SECTION("CHECK strided buffers and row permutations") {
+    // column-major 5x5 inside a buffer with 7 rows, the transpose has the same det
+    std::vector<long double> buffer(7 * 5, -1);
+    for (size_t i = 0; i < 5; ++i) {
+      for (size_t j = 0; j < 5; ++j) {
+        buffer[i + j * 7] = sample::B.matrix[i][j];
+      }
+    }
+    thrd::MatrixView<const long double> transposed(buffer.data(), 5, 5, 7);
+    REQUIRE( std::fabs(thrd::DeterminantLU(transposed) / sample::B.expectedDet - 1) < 1e-12 );
+
+    auto swapped = sample::C.matrix.View().Select({ 1, 0, 2, 3, 4 }, { 0, 1, 2, 3, 4 });
+    REQUIRE(thrd::Determinant(swapped) == -sample::C.expectedDet);
+    REQUIRE(thrd::Determinant(swapped + sample::C.matrix * 0) == -sample::C.expectedDet);
+  }
+
+}
+
+TEST_CASE("Matrix ownership") {
+
+  SECTION("CHECK moves steal the elements") {
+    auto M = sample::RandomMatrix(50);
+    const auto* elements = M[0];
+    auto det = M.DeterminantLU();
+
+    thrd::Matrix<sample::value_t> N(std::move(M));
+    REQUIRE(N[0] == elements);
+    REQUIRE(M.size() == 0);
+
+    M = std::move(N);
+    REQUIRE(M[0] == elements);
+    REQUIRE(M.DeterminantLU() == det);
+
+    sample::Case<sample::value_t> moved(std::move(M), 0);
+    REQUIRE(moved.matrix[0] == elements);
+
+    thrd::Matrix<sample::value_t> copy = moved.matrix;
+    REQUIRE(copy[0] != elements);
+    REQUIRE(copy.DeterminantLU() == det);
+  }
+
+  SECTION("CHECK adopted buffers are used in place and released") {
+    std::unique_ptr<long double[]> owned(new long double[25]);
+    for (size_t i = 0; i < 25; ++i) {
+      owned[i] = sample::B.matrix[i / 5][i % 5];
+    }
+    auto* elements = owned.get();
+    thrd::Matrix<long double> M(std::move(owned), 5);
+    REQUIRE(M[0] == elements);
+    REQUIRE( std::fabs(M.DeterminantLU() / sample::B.expectedDet - 1) < 1e-12 );
+
+    size_t released = 0;
+    std::vector<sample::value_t> buffer(25);
+    std::copy(sample::C.matrix[0], sample::C.matrix[0] + 25, buffer.begin());
+    {
+      thrd::Matrix<sample::value_t> adopted(buffer.data(), 5, [&](sample::value_t*) { ++released; });
+      REQUIRE(adopted.DeterminantLU() == sample::C.expectedDet);
+      auto moved = std::move(adopted);
+      REQUIRE(moved[0] == buffer.data());
+    }
+    REQUIRE(released == 1);
+
+    thrd::Matrix<sample::value_t> borrowed(buffer.data(), 5, nullptr);
+    REQUIRE(borrowed.Determinant(1, thrd::Matrix<sample::value_t>::LAPLACE) == sample::C.expectedDet);
+  }
+
+}
+
+TEST_CASE("Matrix layouts") {
+  using ColumnMajor = thrd::Matrix<sample::value_t, thrd::ColumnMajor>;
+  using Morton = thrd::Matrix<sample::value_t, thrd::Morton<4>>;
+
+  SECTION("CHECK Morton order is a bijection onto the padded storage") {
+    const size_t n = 13;
+    std::vector<int> hits(thrd::Morton<4>::Capacity(n), 0);
+    REQUIRE(hits.size() == 16 * 16);
+    for (size_t i = 0; i < n; ++i) {
+      for (size_t j = 0; j < n; ++j) {
+        ++hits[thrd::Morton<4>::Index(i, j, n)];
+      }
+    }
+    REQUIRE(std::count(hits.begin(), hits.end(), 1) == n * n);
+    REQUIRE(std::count(hits.begin(), hits.end(), 0) == hits.size() - n * n);
+    REQUIRE(thrd::Morton<4>::Index(4, 0, n) == 2 * 16);
+    REQUIRE(thrd::Morton<4>::Index(0, 4, n) == 16);
+
+    // traversal walks the storage forward, one element at a time inside a tile
+    size_t last = 0, count = 0;
+    bool increasing = true;
+    thrd::Morton<4>::Traverse(n, [&](size_t i, size_t j, size_t k) {
+      increasing = increasing && (count == 0 || k > last) && k == thrd::Morton<4>::Index(i, j, n);
+      last = k;
+      ++count;
+    });
+    REQUIRE(increasing);
+    REQUIRE(count == n * n);
+  }
+
+  SECTION("CHECK conversions keep every element") {
+    auto M = sample::RandomMatrix(77);
+    ColumnMajor C = M;
+    Morton Z = C;
+    thrd::Matrix<sample::value_t> R = Z;
+    bool equal = true;
+    for (size_t i = 0; i < 77; ++i) {
+      for (size_t j = 0; j < 77; ++j) {
+        equal = equal && C[i][j] == M[i][j] && Z[i][j] == M[i][j] && R[i][j] == M[i][j];
+      }
+    }
+    REQUIRE(equal);
+    REQUIRE(C.View()(3, 5) == M[3][5]);
+    REQUIRE(C.View().Block(2, 3, 4, 4)(1, 2) == M[3][5]);
+  }
+
+  SECTION("CHECK every method gives the same det in every layout") {
+    ColumnMajor A({
+      { 1, 0, 2, 0, 1, 2 },
+      { 0, 0, 3, 0, 0, 1 },
+      { 0, 3, 0, 2, 2, 0 },
+      { 4, 0, 7, 0, 6, 2 },
+      { 0, 3, 0, 3, 0, 0 },
+      { 0, 1, 2, 0, 0, 4 }
+    });
+    Morton Z = A;
+    for (auto method : { thrd::DeterminantMethods::LAPLACE, thrd::DeterminantMethods::LU, thrd::DeterminantMethods::RLU,
+                         thrd::DeterminantMethods::TILED, thrd::DeterminantMethods::AUTO }) {
+      REQUIRE( std::fabs(A.Determinant(THREADS_COUNT, method) - sample::A.expectedDet) < 1e-9 );
+      REQUIRE( std::fabs(Z.Determinant(THREADS_COUNT, method) - sample::A.expectedDet) < 1e-9 );
+    }
+
+    auto M = sample::RandomMatrix(70);
+    auto det = M.DeterminantLU();
+    REQUIRE( std::fabs(ColumnMajor(M).DeterminantTiled(THREADS_COUNT, 16) - det) <= 1e-9 * std::fabs(det) );
+    REQUIRE( std::fabs(Morton(M).DeterminantRLU(THREADS_COUNT) - det) <= 1e-9 * std::fabs(det) );
+    REQUIRE( std::fabs(Morton(M).DeterminantCertified().det - det) <= 1e-9 * std::fabs(det) );
+  }
+
+  SECTION("CHECK products in non row-major layouts") {
+    auto A = sample::RandomMatrix(21);
+    auto B = sample::TriangleMatrix(21, 2);
+    thrd::Matrix<sample::value_t> expected = A * B;
+    auto C = ColumnMajor(A).Multiply(ColumnMajor(B), THREADS_COUNT);
+    auto Z = Morton(A).Multiply(Morton(B));
+    bool equal = true;
+    for (size_t i = 0; i < 21; ++i) {
+      for (size_t j = 0; j < 21; ++j) {
+        equal = equal && C[i][j] == expected[i][j] && Z[i][j] == expected[i][j];
+      }
+    }
+    REQUIRE(equal);
+  }
+
+}
+
+TEST_CASE("Batch determinants") {
+
+  SECTION("CHECK small matrices are packed and large ones spread") {
+    auto plan = thrd::PlanBatch({ 50, 500, 3, 150, 400 }, 4);
+    REQUIRE(plan.threads == 4);
+    REQUIRE(plan.order == std::vector<size_t>({ 1, 4, 3, 0, 2 }));
+    REQUIRE(plan.workers[0] == 1);
+    REQUIRE(plan.workers[2] == 1);
+    REQUIRE(plan.workers[1] == std::min<size_t>(4, 500 / thrd::Tuning::Get().rowsPerThread));
+    REQUIRE(plan.workers[1] >= plan.workers[4]);
+  }
+
+  SECTION("CHECK results come back in submission order") {
+    std::vector< thrd::Matrix<sample::value_t> > batch;
+    std::vector<long double> expected;
+    for (auto n : { 5, 40, 200, 12, 80, 5, 160 }) {
+      batch.push_back(sample::RandomMatrix(n));
+      expected.push_back(batch.back().DeterminantLU());
+    }
+    batch.push_back(sample::B.matrix);
+    expected.push_back(sample::B.expectedDet);
+
+    auto results = thrd::DeterminantBatch(batch, THREADS_COUNT);
+    REQUIRE(results.size() == expected.size());
+    for (size_t i = 0; i < results.size(); ++i) {
+      REQUIRE( std::fabs(results[i] - expected[i]) <= 1e-9 * std::fabs(expected[i]) );
+    }
+    REQUIRE(thrd::DeterminantBatch(batch, 3, thrd::DeterminantMethods::AUTO).size() == batch.size());
+    std::vector< thrd::Matrix<sample::value_t> > empty;
+    REQUIRE(thrd::DeterminantBatch(empty).empty());
+  }
+
+}
+
+TEST_CASE("Sample generators") {
+
+  SECTION("CHECK generators are reproducible and don't depend on the fill order") {
+    const size_t n = 70;
+    auto M = sample::RandomMatrix(n, 7);
+    auto N = sample::RandomMatrix(n, 7);
+    auto O = sample::RandomMatrix(n, 8);
+    sample::Random rng(7);
+    bool same = true, differs = false;
+    for (size_t i = 0; i < n; ++i) {
+      for (size_t j = 0; j < n; ++j) {
+        same = same && M[i][j] == N[i][j] && M[i][j] == static_cast<sample::value_t>(rng.Bits(i * n + j) % 10);
+        differs = differs || M[i][j] != O[i][j];
+      }
+    }
+    REQUIRE(same);
+    REQUIRE(differs);
+    REQUIRE(sample::TriangleMatrix(n, 3, 5).IsTriangular());
+  }
+
+  SECTION("CHECK distributions") {
+    const size_t n = 120;
+    auto U = sample::UniformMatrix(n, 1, 2, 3);
+    auto G = sample::NormalMatrix(n, 1);
+    auto S = sample::SparseMatrix(n, 0.1, 1);
+    auto B = sample::BandedMatrix(n, 2, 1, 1);
+    double inRange = 0, mean = 0, var = 0, nonzeros = 0;
+    bool banded = true;
+    for (size_t i = 0; i < n; ++i) {
+      for (size_t j = 0; j < n; ++j) {
+        inRange += U[i][j] >= 2 && U[i][j] < 3;
+        mean += G[i][j];
+        var += G[i][j] * G[i][j];
+        nonzeros += S[i][j] != 0;
+        if (j + 2 < i || j > i + 1) banded = banded && B[i][j] == 0;
+        else banded = banded && B[i][j] != 0;
+      }
+    }
+    REQUIRE(inRange == n * n);
+    REQUIRE(std::fabs(mean / (n * n)) < 0.05);
+    REQUIRE(std::fabs(var / (n * n) - 1) < 0.05);
+    REQUIRE(std::fabs(nonzeros / (n * n) - 0.1) < 0.02);
+    REQUIRE(banded);
+  }
+
+  SECTION("CHECK conditioned and SPD matrices") {
+    const size_t n = 40;
+    const double cond = 1e4;
+    auto C = sample::ConditionedMatrix(n, cond, 3);
+    auto expected = std::pow(cond, -0.5 * n);
+    REQUIRE( std::fabs(C.DeterminantLU() - expected) < 1e-6 * expected );
+
+    auto P = sample::SpdMatrix(n, 3);
+    bool symmetric = true;
+    for (size_t i = 0; i < n; ++i) {
+      for (size_t j = 0; j < n; ++j) symmetric = symmetric && P[i][j] == P[j][i];
+    }
+    REQUIRE(symmetric);
+    REQUIRE(P.DeterminantLU() > 0);
+  }
+
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "expression.hpp"
+
+
+namespace thrd {
+
+/*
+  Non-owning window into a matrix stored elsewhere: a pointer, the number of
+  rows and columns and the distances between rows and between columns. Rows
+  and columns can also go through index maps, so minors and permuted or
+  scattered selections are views too. Nothing is copied, the storage must
+  outlive the view.
+*/
+template<typename T>
+class MatrixView : public Expression< MatrixView<T> >
+{
+public:
+  using value_type = typename std::remove_const<T>::type;
+  using map_t = typename std::shared_ptr< const std::vector<size_t> >;
+
+  virtual ~MatrixView() = default;
+
+  MatrixView();
+  MatrixView(T*, const size_t, const size_t, const size_t, const size_t = 1, map_t = nullptr, map_t = nullptr);
+  template<typename U, typename = typename std::enable_if< std::is_convertible<U*, T*>::value >::type>
+  MatrixView(const MatrixView<U>&);
+
+  explicit operator bool() const { return _data != nullptr; };
+
+  // views taken by the determinant are square, size() is the number of rows
+  const size_t size() const { return _rows; };
+  const size_t Rows() const { return _rows; };
+  const size_t Cols() const { return _cols; };
+  const size_t Stride() const { return _stride; };
+  const size_t ColStride() const { return _colStride; };
+
+  T& operator()(const size_t i, const size_t j) const { return _data[Row(i) * _stride + Col(j) * _colStride]; };
+
+  MatrixView Block(const size_t, const size_t, const size_t, const size_t) const;
+  MatrixView Minor(const size_t, const size_t) const;
+  MatrixView Select(const std::vector<size_t>&, const std::vector<size_t>&) const;
+
+private:
+  template<typename> friend class MatrixView;
+
+  T* _data;
+  size_t _rows;
+  size_t _cols;
+  size_t _stride;
+  size_t _colStride;
+  map_t _rowMap;
+  map_t _colMap;
+
+  size_t Row(const size_t i) const { return _rowMap ? (*_rowMap)[i] : i; };
+  size_t Col(const size_t j) const { return _colMap ? (*_colMap)[j] : j; };
+  map_t Map(const size_t, const size_t, const size_t, const bool) const;
+};
+
+
+template<typename T>
+MatrixView<T>::MatrixView() : _data(nullptr), _rows(0), _cols(0), _stride(0), _colStride(1) {};
+
+template<typename T>
+MatrixView<T>::MatrixView(
+    T*            data,
+    const size_t  rows,
+    const size_t  cols,
+    const size_t  stride,
+    const size_t  colStride,
+    map_t         rowMap,
+    map_t         colMap)
+  : _data(data), _rows(rows), _cols(cols), _stride(stride), _colStride(colStride), _rowMap(rowMap), _colMap(colMap)
+{
+  if ((_rowMap && _rowMap->size() < rows) || (_colMap && _colMap->size() < cols)) {
+    throw std::invalid_argument("index map is shorter than the view");
+  }
+};
+
+template<typename T>
+template<typename U, typename>
+MatrixView<T>::MatrixView(const MatrixView<U>& other)
+  : _data(other._data), _rows(other._rows), _cols(other._cols), _stride(other._stride), _colStride(other._colStride),
+    _rowMap(other._rowMap), _colMap(other._colMap) {};
+
+// count indices of a mapped axis starting from first, without skip
+template<typename T>
+typename MatrixView<T>::map_t MatrixView<T>::Map(const size_t first, const size_t count, const size_t skip, const bool rows) const
+{
+  auto map = std::make_shared< std::vector<size_t> >();
+  map->reserve(count);
+  for (size_t i = first; map->size() < count; ++i) {
+    if (i != skip) map->push_back(rows ? Row(i) : Col(i));
+  }
+  return map;
+}
+
+// rows x cols block starting at (row, col), unmapped axes only move the pointer
+template<typename T>
+MatrixView<T> MatrixView<T>::Block(const size_t row, const size_t col, const size_t rows, const size_t cols) const
+{
+  if (row + rows > _rows || col + cols > _cols) {
+    throw std::out_of_range("block is out of the view");
+  }
+
+  auto data = _data;
+  map_t rowMap, colMap;
+  if (_rowMap) rowMap = Map(row, rows, _rows, true);
+  else data += row * _stride;
+  if (_colMap) colMap = Map(col, cols, _cols, false);
+  else data += col * _colStride;
+  return MatrixView(data, rows, cols, _stride, _colStride, rowMap, colMap);
+}
+
+// without the given row and column
+template<typename T>
+MatrixView<T> MatrixView<T>::Minor(const size_t row, const size_t col) const
+{
+  if (row >= _rows || col >= _cols) {
+    throw std::out_of_range("minor is out of the view");
+  }
+  return MatrixView(_data, _rows - 1, _cols - 1, _stride, _colStride, Map(0, _rows - 1, row, true), Map(0, _cols - 1, col, false));
+}
+
+// the given rows and columns, in the given order
+template<typename T>
+MatrixView<T> MatrixView<T>::Select(const std::vector<size_t>& rows, const std::vector<size_t>& cols) const
+{
+  auto rowMap = std::make_shared< std::vector<size_t> >(rows.size());
+  auto colMap = std::make_shared< std::vector<size_t> >(cols.size());
+  for (size_t i = 0; i < rows.size(); ++i) {
+    if (rows[i] >= _rows) throw std::out_of_range("row is out of the view");
+    (*rowMap)[i] = Row(rows[i]);
+  }
+  for (size_t j = 0; j < cols.size(); ++j) {
+    if (cols[j] >= _cols) throw std::out_of_range("column is out of the view");
+    (*colMap)[j] = Col(cols[j]);
+  }
+  return MatrixView(_data, rows.size(), cols.size(), _stride, _colStride, rowMap, colMap);
+}
+
+} // namespace thrd